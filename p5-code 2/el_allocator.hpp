@@ -0,0 +1,122 @@
+// el_allocator.hpp: C++ bindings for the explicit list allocator so
+// that standard containers can keep their storage in the el heap.
+//
+//   el::heap heap;                                  // el_init() / el_cleanup()
+//   std::vector<int, el::allocator<int>> v;         // Allocator requirements
+//
+//   el::memory_resource res;                        // std::pmr interface
+//   std::pmr::unordered_map<int,int> m(&res);
+//
+// Both use el_malloc_aligned() with the alignment of the stored type
+// as el_malloc() alone does not align blocks, and free with
+// el_free(). When the heap is full it is grown with
+// el_append_pages_to_heap() and the allocation retried; if the heap
+// can't grow std::bad_alloc is thrown. Like the C interface these are
+// not thread-safe: the el heap must only be used from one thread.
+#ifndef EL_ALLOCATOR_HPP
+#define EL_ALLOCATOR_HPP 1
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <memory_resource>
+#include "el_malloc.h"
+
+namespace el {
+
+namespace detail {
+
+// Allocate bytes aligned to align from the el heap, growing the heap
+// as needed. The heap grows by at least a quarter of its current size
+// so that a run of allocations doesn't append pages one at a time.
+inline void *allocate_bytes(std::size_t bytes, std::size_t align){
+  if(bytes == 0){
+    bytes = 1;
+  }
+  for(;;){
+    void *ptr = el_malloc_aligned(align, bytes);
+    if(ptr != nullptr){
+      return ptr;
+    }
+    std::size_t need  = bytes + align + 2*EL_BLOCK_OVERHEAD;
+    std::size_t pages = (need + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES;
+    std::size_t quarter = el_ctl->heap_bytes / EL_PAGE_BYTES / 4;
+    if(pages < quarter){
+      pages = quarter;
+    }
+    if(pages > (std::size_t) std::numeric_limits<int>::max() ||
+       el_append_pages_to_heap((int) pages) != 0)
+    {
+      throw std::bad_alloc();
+    }
+  }
+}
+
+} // namespace detail
+
+// Sets up the el heap for the lifetime of the object; only one may
+// exist at a time.
+struct heap {
+  heap(){
+    if(el_init() != 0){
+      throw std::bad_alloc();
+    }
+  }
+  ~heap(){
+    el_cleanup();
+  }
+  heap(const heap &) = delete;
+  heap &operator=(const heap &) = delete;
+};
+
+// Stateless allocator meeting the C++ Allocator requirements; all
+// instances share the single el heap and compare equal.
+template <typename T>
+struct allocator {
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using is_always_equal = std::true_type;
+
+  allocator() noexcept = default;
+  template <typename U>
+  allocator(const allocator<U> &) noexcept {}
+
+  T *allocate(std::size_t n){
+    if(n > std::numeric_limits<std::size_t>::max() / sizeof(T)){
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T *>(detail::allocate_bytes(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, std::size_t) noexcept {
+    el_free(ptr);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+// Polymorphic memory resource backed by the el heap for use with the
+// std::pmr containers. All instances share the heap so memory from
+// one may be released through another.
+class memory_resource : public std::pmr::memory_resource {
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t align) override {
+    return detail::allocate_bytes(bytes, align);
+  }
+
+  void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+    el_free(ptr);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return dynamic_cast<const memory_resource *>(&other) != nullptr;
+  }
+};
+
+} // namespace el
+
+#endif
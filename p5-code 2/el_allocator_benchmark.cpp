@@ -0,0 +1,169 @@
+// el_allocator_benchmark.cpp: compares container heavy workloads
+// using std::allocator against the el heap through el::allocator and
+// el::memory_resource.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "el_allocator.hpp"
+
+int REPEATS = 5;
+long N = 20000;
+
+// pseudo-random keys; same sequence for every allocator
+static unsigned long key_state = 1;
+static int next_key(){
+  key_state = key_state * 1103515245 + 12345;
+  return (int) ((key_state / 65536) % 1000000);
+}
+
+// Each workload builds and tears down containers using allocator
+// type A (or the memory resource for the pmr versions) and returns a
+// checksum so the work can't be optimized away.
+
+template <typename A>
+long vector_workload(const A &alloc){
+  long sum = 0;
+  std::vector<int, typename std::allocator_traits<A>::template rebind_alloc<int>> vec(alloc);
+  for(long i=0; i<N*10; i++){
+    vec.push_back((int) i);
+  }
+  for(long i=0; i<(long) vec.size(); i++){
+    sum += vec[i];
+  }
+  return sum;
+}
+
+template <typename A>
+long map_workload(const A &alloc){
+  using pair_alloc = typename std::allocator_traits<A>::template rebind_alloc<std::pair<const int,int>>;
+  std::map<int, int, std::less<int>, pair_alloc> map(alloc);
+  key_state = 1;
+  for(long i=0; i<N; i++){
+    map[next_key()] += 1;
+  }
+  for(long i=0; i<N/2; i++){
+    map.erase(next_key());
+  }
+  return (long) map.size();
+}
+
+template <typename A>
+long unordered_workload(const A &alloc){
+  using pair_alloc = typename std::allocator_traits<A>::template rebind_alloc<std::pair<const int,int>>;
+  std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, pair_alloc> map(16, std::hash<int>(), std::equal_to<int>(), alloc);
+  key_state = 1;
+  for(long i=0; i<N; i++){
+    map[next_key()] += 1;
+  }
+  long hits = 0;
+  for(long i=0; i<N; i++){
+    hits += map.count(next_key());
+  }
+  for(long i=0; i<N/2; i++){
+    map.erase(next_key());
+  }
+  return hits + (long) map.size();
+}
+
+template <typename A>
+long string_list_workload(const A &alloc){
+  using char_alloc = typename std::allocator_traits<A>::template rebind_alloc<char>;
+  using string_t = std::basic_string<char, std::char_traits<char>, char_alloc>;
+  using string_alloc = typename std::allocator_traits<A>::template rebind_alloc<string_t>;
+  std::list<string_t, string_alloc> list(alloc);
+  long len = 0;
+  for(long i=0; i<N; i++){
+    string_t s(alloc);
+    for(int j=0; j<(int) (i % 40) + 20; j++){   // long enough to leave the small string buffer
+      s.push_back('a' + j % 26);
+    }
+    list.push_back(s);
+    if(i % 3 == 0){
+      list.pop_front();
+    }
+  }
+  for(auto &s : list){
+    len += (long) s.size();
+  }
+  return len;
+}
+
+// pmr containers take the memory resource in place of an allocator
+long vector_workload_pmr(std::pmr::memory_resource *res){
+  return vector_workload(std::pmr::polymorphic_allocator<int>(res));
+}
+long map_workload_pmr(std::pmr::memory_resource *res){
+  return map_workload(std::pmr::polymorphic_allocator<int>(res));
+}
+long unordered_workload_pmr(std::pmr::memory_resource *res){
+  return unordered_workload(std::pmr::polymorphic_allocator<int>(res));
+}
+long string_list_workload_pmr(std::pmr::memory_resource *res){
+  return string_list_workload(std::pmr::polymorphic_allocator<int>(res));
+}
+
+// Time REPEATS runs of the workload in seconds of wall time. The el
+// heap is set up fresh for each run so runs don't see each other's
+// fragmentation.
+template <typename F>
+double time_workload(F workload, bool use_el, long *check){
+  auto beg = std::chrono::steady_clock::now();
+  for(int i=0; i<REPEATS; i++){
+    if(use_el){
+      el::heap heap;
+      *check = workload();
+    }
+    else{
+      *check = workload();
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - beg).count();
+}
+
+int main(int argc, char *argv[]){
+  if(argc > 1 && strcmp(argv[1],"-test")==0){
+    REPEATS = 1;                // quick run for testing
+    N = 2000;
+  }
+
+  printf("==== el Allocator Container Benchmark ====\n");
+  printf("Running %d repeats with N=%ld\n", REPEATS, N);
+  printf("%-14s %8s %8s %8s %7s %7s\n", "WORKLOAD", "STD", "EL", "EL_PMR", "EL/STD", "PMR/STD");
+
+  std::allocator<int> std_alloc;
+  el::allocator<int> el_alloc;
+  el::memory_resource el_res;
+
+  struct {
+    const char *name;
+    long (*std_fn)(const std::allocator<int> &);
+    long (*el_fn)(const el::allocator<int> &);
+    long (*pmr_fn)(std::pmr::memory_resource *);
+  } workloads[] = {
+    {"vector",        vector_workload,      vector_workload,      vector_workload_pmr},
+    {"map",           map_workload,         map_workload,         map_workload_pmr},
+    {"unordered_map", unordered_workload,   unordered_workload,   unordered_workload_pmr},
+    {"string_list",   string_list_workload, string_list_workload, string_list_workload_pmr},
+  };
+
+  for(auto &w : workloads){
+    long check_std, check_el, check_pmr;
+    double t_std = time_workload([&]{ return w.std_fn(std_alloc); }, false, &check_std);
+    double t_el  = time_workload([&]{ return w.el_fn(el_alloc);   }, true,  &check_el);
+    double t_pmr = time_workload([&]{ return w.pmr_fn(&el_res);   }, true,  &check_pmr);
+    printf("%-14s %8.4f %8.4f %8.4f %7.2f %7.2f\n",
+           w.name, t_std, t_el, t_pmr, t_el / t_std, t_pmr / t_std);
+    if(check_std != check_el || check_std != check_pmr){
+      printf("ERROR: %s results differ: std %ld el %ld pmr %ld\n",
+             w.name, check_std, check_el, check_pmr);
+    }
+  }
+  return 0;
+}
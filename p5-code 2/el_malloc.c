@@ -3,15 +3,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <execinfo.h>
+#include <pthread.h>
 #include "el_malloc.h"
+#include "probes.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // global control functions
 
+// Static tracepoints, provider 'el' (see probes.h):
+//   malloc_entry  (nbytes, lifetime, avail length)
+//   malloc_return (nbytes, ptr or NULL, avail length, used length)
+//   free          (ptr, block size, avail length, used length)
+//   split         (block, new size, new block above, size of new block)
+//   merge         (lower block, higher block, merged size)
+//   heap_grow     (npages, new block, heap bytes)
+//   heap_trim     (bytes released, heap bytes)
+//   compact_entry (avail length, avail bytes)
+//   compact_return(bytes moved, avail length, avail bytes)
+
 // Global control variable for the allocator. Must be initialized in
 // el_init().
 el_ctl_t *el_ctl = NULL;
 
+// heap prefaulting helpers, defined along with el_set_prefault()
+static size_t el_prefault_take();
+static void el_prefault_discard();
+static void el_prefault_check();
+static int el_grow_for(size_t nbytes);
+
+// handle table cleanup, defined with el_halloc()
+static void el_handles_free();
+
 // Create an initial block of memory for the heap using
 // mmap(). Initialize the el_ctl data structure to point at this
 // block. The initializ size/position of the heap for the memory map
@@ -50,6 +75,11 @@ int el_init(){
   el_init_blocklist(&el_ctl->used_actual);
   el_ctl->avail = &el_ctl->avail_actual;
   el_ctl->used  = &el_ctl->used_actual;
+  el_ctl->clock = 0;
+  memset(el_ctl->lifestats, 0, sizeof(el_ctl->lifestats));
+  el_ctl->prefault_mode = EL_PREFAULT_OFF;
+  el_ctl->prefault_pages = 0;
+  el_ctl->prefault_watermark = 0;
 
   // establish the first available block by filling in size in
   // block/foot and null links in head
@@ -76,6 +106,9 @@ int el_init(){
 // Clean up the heap area associated with the system which unmaps all
 // pages associated with the heap.
 void el_cleanup(){
+  el_prof_stop();
+  el_handles_free();
+  el_set_prefault(EL_PREFAULT_OFF, 0, 0);
   munmap(el_ctl->heap_start, el_ctl->heap_bytes);
   munmap(el_ctl, EL_PAGE_BYTES);
 }
@@ -278,6 +311,386 @@ void el_remove_block(el_blocklist_t *list, el_blockhead_t *block) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Sampling heap profiler
+//
+// When started with el_prof_start(N), roughly one allocation per N
+// bytes allocated is sampled. The distance in bytes between samples
+// is drawn from an exponential distribution with mean N (Poisson
+// sampling) so that allocations of every size are sampled in
+// proportion to their bytes and a call costs only a subtraction when
+// it is not sampled. For a sampled allocation the call stack is
+// recorded and the block is tagged with EL_FLAG_SAMPLED so that
+// el_free() can retire it from the live totals of its site. Each
+// sample is weighted by the inverse of its sampling probability so
+// that the site totals estimate the true bytes and object counts. The
+// unweighted number and bytes of the samples are kept as well for the
+// pprof format, whose reader does its own unsampling.
+//
+// Profiler data is kept in the regular process heap, not the el heap,
+// so profiling does not change the layout of the el heap.
+
+// One allocation site: a distinct call stack leading to el_malloc()
+typedef struct {
+  void *frames[EL_PROF_MAX_DEPTH]; // return addresses, innermost first
+  int depth;                    // number of frames; 0 for an unused slot
+  double live_count;            // estimated objects allocated here and not yet freed
+  double live_bytes;            // estimated bytes allocated here and not yet freed
+  double total_count;           // estimated objects ever allocated here
+  double total_bytes;           // estimated bytes ever allocated here
+  long live_samples;            // sampled objects allocated here and not yet freed
+  size_t live_sampled;          // their bytes as requested
+  long total_samples;           // sampled objects ever allocated here
+  size_t total_sampled;         // their bytes as requested
+} el_prof_site_t;
+
+// Entry for a live sampled block in the open addressing table mapping
+// blocks to their site.
+typedef struct {
+  el_blockhead_t *block;        // sampled block, NULL if empty or EL_PROF_TOMBSTONE if deleted
+  int site;                     // index of the site in el_prof.sites
+  double count;                 // weight added to the site's counts
+  double bytes;                 // weight added to the site's bytes
+  size_t nbytes;                // bytes requested for the block
+} el_prof_sample_t;
+
+#define EL_PROF_TOMBSTONE ((el_blockhead_t *) 1)
+
+// Global state of the profiler; sample_bytes is 0 when stopped.
+static struct {
+  size_t sample_bytes;          // mean bytes between samples
+  long countdown;               // bytes left to allocate before the next sample
+  uint64_t rng;                 // xorshift state for drawing sample distances
+  el_prof_site_t *sites;        // hash table of EL_PROF_MAX_SITES sites
+  int nsites;                   // number of sites in use
+  el_prof_sample_t *samples;    // table of live sampled blocks
+  size_t samples_cap;           // slots in samples, a power of 2
+  size_t samples_used;          // slots that are in use or tombstones
+} el_prof = {0};
+
+// Check whether the allocation of nbytes at ptr should be sampled;
+// used in the public allocation functions so that the recorded stack
+// starts at their caller. A macro rather than a function for that
+// reason, wrapped so that it is a single statement.
+#define EL_PROF_CHECK(ptr, nbytes)                                      \
+  do{                                                                   \
+    if(el_prof.sample_bytes != 0 && (ptr) != NULL &&                    \
+       (el_prof.countdown -= (long) (nbytes)) < 0){                     \
+      el_prof_sample(ptr, nbytes);                                      \
+    }                                                                   \
+  }while(0)
+
+// Draw the number of bytes until the next sample from an exponential
+// distribution with mean el_prof.sample_bytes.
+static long el_prof_next_distance(){
+  el_prof.rng ^= el_prof.rng << 13;
+  el_prof.rng ^= el_prof.rng >> 7;
+  el_prof.rng ^= el_prof.rng << 17;
+  double u = ((el_prof.rng >> 11) + 1) * (1.0 / 9007199254740993.0); // in (0,1]
+  return (long) (-log(u) * el_prof.sample_bytes) + 1;
+}
+
+// Start profiling with about one sample for every sample_bytes bytes
+// allocated. Restarting discards previously collected data. Returns 0
+// on success and 1 if the profiler tables can't be allocated.
+int el_prof_start(size_t sample_bytes){
+  el_prof_stop();
+  if(sample_bytes == 0){
+    return 0;
+  }
+  el_prof.sites = calloc(EL_PROF_MAX_SITES, sizeof(el_prof_site_t));
+  el_prof.samples_cap = 256;
+  el_prof.samples = calloc(el_prof.samples_cap, sizeof(el_prof_sample_t));
+  if(el_prof.sites == NULL || el_prof.samples == NULL){
+    el_prof_stop();
+    return 1;
+  }
+  el_prof.sample_bytes = sample_bytes;
+  el_prof.rng = 0x9E3779B97F4A7C15UL;
+  el_prof.countdown = el_prof_next_distance();
+  return 0;
+}
+
+// Stop profiling and release all profiler data. Blocks that are still
+// tagged as sampled are ignored when freed afterwards.
+void el_prof_stop(){
+  free(el_prof.sites);
+  free(el_prof.samples);
+  memset(&el_prof, 0, sizeof(el_prof));
+}
+
+// Hash a pointer for use in the profiler tables.
+static size_t el_prof_hash(const void *p){
+  uint64_t x = (uint64_t) (size_t) p;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  return (size_t) x;
+}
+
+// Return the index of the site for the given stack, adding it if it
+// is new. Returns -1 if the site table is full.
+static int el_prof_find_site(void **frames, int depth){
+  size_t h = depth;
+  for(int i=0; i<depth; i++){
+    h = h*31 + el_prof_hash(frames[i]);
+  }
+  for(int probe=0; probe<EL_PROF_MAX_SITES; probe++){
+    int idx = (h + probe) % EL_PROF_MAX_SITES;
+    el_prof_site_t *site = &el_prof.sites[idx];
+    if(site->depth == 0){
+      if(el_prof.nsites >= EL_PROF_MAX_SITES/2){ // keep probe sequences short
+        return -1;
+      }
+      memcpy(site->frames, frames, depth * sizeof(void *));
+      site->depth = depth;
+      el_prof.nsites++;
+      return idx;
+    }
+    if(site->depth == depth && memcmp(site->frames, frames, depth*sizeof(void *)) == 0){
+      return idx;
+    }
+  }
+  return -1;
+}
+
+// Double the size of the live sample table, dropping tombstones.
+static int el_prof_grow_samples(){
+  size_t old_cap = el_prof.samples_cap;
+  el_prof_sample_t *old = el_prof.samples;
+  el_prof_sample_t *new = calloc(old_cap*2, sizeof(el_prof_sample_t));
+  if(new == NULL){
+    return 1;
+  }
+  el_prof.samples = new;
+  el_prof.samples_cap = old_cap*2;
+  el_prof.samples_used = 0;
+  for(size_t i=0; i<old_cap; i++){
+    if(old[i].block != NULL && old[i].block != EL_PROF_TOMBSTONE){
+      size_t j = el_prof_hash(old[i].block) & (el_prof.samples_cap-1);
+      while(new[j].block != NULL){
+        j = (j+1) & (el_prof.samples_cap-1);
+      }
+      new[j] = old[i];
+      el_prof.samples_used++;
+    }
+  }
+  free(old);
+  return 0;
+}
+
+// Add a sample to the table of live sampled blocks which must have
+// room for it.
+static void el_prof_insert(el_prof_sample_t sample){
+  size_t j = el_prof_hash(sample.block) & (el_prof.samples_cap-1);
+  while(el_prof.samples[j].block != NULL && el_prof.samples[j].block != EL_PROF_TOMBSTONE){
+    j = (j+1) & (el_prof.samples_cap-1);
+  }
+  if(el_prof.samples[j].block == NULL){
+    el_prof.samples_used++;
+  }
+  el_prof.samples[j] = sample;
+}
+
+// Record a sample for the just allocated block at ptr: capture the
+// call stack, add the weighted sample to its site and remember the
+// block so it can be retired when freed. Not inlined so that the
+// stack always begins with this function and the allocation function.
+__attribute__((noinline))
+static void el_prof_sample(void *ptr, size_t nbytes){
+  while(el_prof.countdown < 0){
+    el_prof.countdown += el_prof_next_distance();
+  }
+
+  void *frames[EL_PROF_MAX_DEPTH+2];
+  int depth = backtrace(frames, EL_PROF_MAX_DEPTH+2) - 2; // skip this function and el_malloc()
+  if(depth <= 0){
+    return;
+  }
+  int site = el_prof_find_site(frames+2, depth);
+  if(site < 0){
+    return;
+  }
+  if((el_prof.samples_used+1)*2 > el_prof.samples_cap && el_prof_grow_samples() != 0){
+    return;
+  }
+
+  // a block of size s is sampled with probability 1-exp(-s/N)
+  double prob = 1.0 - exp(-(double) nbytes / el_prof.sample_bytes);
+  el_prof_sample_t sample = {
+    .block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)),
+    .site  = site,
+    .count = 1.0 / prob,
+    .bytes = nbytes / prob,
+    .nbytes = nbytes,
+  };
+  el_prof_site_t *s = &el_prof.sites[site];
+  s->live_count  += sample.count;
+  s->live_bytes  += sample.bytes;
+  s->total_count += sample.count;
+  s->total_bytes += sample.bytes;
+  s->live_samples++;
+  s->live_sampled  += nbytes;
+  s->total_samples++;
+  s->total_sampled += nbytes;
+
+  el_prof_insert(sample);
+  sample.block->flags |= EL_FLAG_SAMPLED;
+}
+
+// Remove a sampled block that is being freed from the live totals of
+// its site.
+static void el_prof_retire(el_blockhead_t *block){
+  block->flags &= ~EL_FLAG_SAMPLED;
+  if(el_prof.samples == NULL){
+    return;
+  }
+  size_t j = el_prof_hash(block) & (el_prof.samples_cap-1);
+  while(el_prof.samples[j].block != NULL){
+    if(el_prof.samples[j].block == block){
+      el_prof_sample_t *sample = &el_prof.samples[j];
+      el_prof_site_t *s = &el_prof.sites[sample->site];
+      s->live_count -= sample->count;
+      s->live_bytes -= sample->bytes;
+      s->live_samples--;
+      s->live_sampled -= sample->nbytes;
+      sample->block = EL_PROF_TOMBSTONE;
+      return;
+    }
+    j = (j+1) & (el_prof.samples_cap-1);
+  }
+}
+
+// Update the table of live sampled blocks for a sampled block that
+// heap compaction moved from old to new.
+static void el_prof_move(el_blockhead_t *old, el_blockhead_t *new){
+  if(el_prof.samples == NULL){
+    return;
+  }
+  size_t j = el_prof_hash(old) & (el_prof.samples_cap-1);
+  while(el_prof.samples[j].block != NULL){
+    if(el_prof.samples[j].block == old){
+      el_prof_sample_t sample = el_prof.samples[j];
+      el_prof.samples[j].block = EL_PROF_TOMBSTONE;
+      sample.block = new;
+      if((el_prof.samples_used+1)*2 > el_prof.samples_cap && el_prof_grow_samples() != 0){
+        el_prof_site_t *s = &el_prof.sites[sample.site]; // can't track it any longer
+        s->live_count -= sample.count;
+        s->live_bytes -= sample.bytes;
+        s->live_samples--;
+        s->live_sampled -= sample.nbytes;
+        new->flags &= ~EL_FLAG_SAMPLED;
+        return;
+      }
+      el_prof_insert(sample);
+      return;
+    }
+    j = (j+1) & (el_prof.samples_cap-1);
+  }
+}
+
+// Print a summary of the profile: number of sites along with the
+// estimated live and total objects and bytes over all sites.
+void el_prof_print_stats(){
+  double live_count=0, live_bytes=0, total_count=0, total_bytes=0;
+  for(int i=0; el_prof.sites != NULL && i<EL_PROF_MAX_SITES; i++){
+    el_prof_site_t *s = &el_prof.sites[i];
+    live_count  += s->live_count;
+    live_bytes  += s->live_bytes;
+    total_count += s->total_count;
+    total_bytes += s->total_bytes;
+  }
+  printf("HEAP PROFILE (sample every %lu bytes)\n", el_prof.sample_bytes);
+  printf("sites: %d\n", el_prof.nsites);
+  printf("live:  %.0f objects  %.0f bytes\n", live_count, live_bytes);
+  printf("total: %.0f objects  %.0f bytes\n", total_count, total_bytes);
+}
+
+// Write the name of the function containing a return address to out,
+// or the address itself if it has no symbol.
+static void el_prof_write_frame(FILE *out, void *addr){
+  char **names = backtrace_symbols(&addr, 1);
+  char *open = names ? strchr(names[0], '(') : NULL;
+  char *end = open ? strpbrk(open, "+)") : NULL;
+  if(open != NULL && end != NULL && end > open+1){
+    fprintf(out, "%.*s", (int) (end - open - 1), open+1);
+  }
+  else{
+    fprintf(out, "%p", addr);
+  }
+  free(names);
+}
+
+// Dump the collected profile to out in one of the following formats.
+//
+// EL_PROF_FOLDED_LIVE / EL_PROF_FOLDED_TOTAL: one line per site with
+// the stack outermost function first separated by semicolons and
+// then the live or total bytes, the input format of flamegraph.pl.
+//
+//   main;handle_request;make_buffer 4096
+//
+// EL_PROF_PPROF: the legacy heap profile text format written by
+// gperftools which pprof reads along with the program binary. The
+// counts and bytes are those of the samples themselves; pprof scales
+// them up by the sampling rate given in the heap_v2 header.
+//
+// Returns 0 on success and 1 if the profiler is not running or the
+// format is unknown.
+int el_prof_dump(FILE *out, int format){
+  if(el_prof.sites == NULL){
+    return 1;
+  }
+  if(format == EL_PROF_FOLDED_LIVE || format == EL_PROF_FOLDED_TOTAL){
+    for(int i=0; i<EL_PROF_MAX_SITES; i++){
+      el_prof_site_t *s = &el_prof.sites[i];
+      double bytes = format == EL_PROF_FOLDED_LIVE ? s->live_bytes : s->total_bytes;
+      if(s->depth == 0 || bytes < 0.5){
+        continue;
+      }
+      for(int f=s->depth-1; f>=0; f--){
+        el_prof_write_frame(out, s->frames[f]);
+        fprintf(out, f > 0 ? ";" : " ");
+      }
+      fprintf(out, "%.0f\n", bytes);
+    }
+    return 0;
+  }
+  if(format == EL_PROF_PPROF){
+    long lc=0, tc=0;
+    size_t lb=0, tb=0;
+    for(int i=0; i<EL_PROF_MAX_SITES; i++){
+      lc += el_prof.sites[i].live_samples;  lb += el_prof.sites[i].live_sampled;
+      tc += el_prof.sites[i].total_samples; tb += el_prof.sites[i].total_sampled;
+    }
+    fprintf(out, "heap profile: %6ld: %8lu [%6ld: %8lu] @ heap_v2/%lu\n",
+            lc, lb, tc, tb, el_prof.sample_bytes);
+    for(int i=0; i<EL_PROF_MAX_SITES; i++){
+      el_prof_site_t *s = &el_prof.sites[i];
+      if(s->depth == 0){
+        continue;
+      }
+      fprintf(out, "%6ld: %8lu [%6ld: %8lu] @",
+              s->live_samples, s->live_sampled, s->total_samples, s->total_sampled);
+      for(int f=0; f<s->depth; f++){
+        fprintf(out, " %p", s->frames[f]);
+      }
+      fprintf(out, "\n");
+    }
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if(maps != NULL){
+      char buf[4096];
+      size_t n;
+      while((n = fread(buf, 1, sizeof(buf), maps)) > 0){
+        fwrite(buf, 1, n, out);
+      }
+      fclose(maps);
+    }
+    return 0;
+  }
+  return 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Allocation-related functions
 
@@ -296,6 +709,34 @@ el_blockhead_t *el_find_first_avail(size_t size){
     return NULL; // No suitable block found
 }
 
+// Find the available block with the lowest address that has block
+// size of at least `size`. Scans the whole available list. Used to
+// place long-lived blocks as low in the heap as possible. Returns
+// NULL if no block of sufficient size is available.
+el_blockhead_t *el_find_lowest_avail(size_t size){
+  el_blockhead_t *found = NULL;
+  for(el_blockhead_t *cur = el_ctl->avail->beg->next; cur != el_ctl->avail->end; cur = cur->next){
+    if(cur->size >= size && (found == NULL || cur < found)){
+      found = cur;
+    }
+  }
+  return found;
+}
+
+// Find the available block with the highest address that has block
+// size of at least `size`. Scans the whole available list. Used to
+// place short-lived blocks as high in the heap as possible. Returns
+// NULL if no block of sufficient size is available.
+el_blockhead_t *el_find_highest_avail(size_t size){
+  el_blockhead_t *found = NULL;
+  for(el_blockhead_t *cur = el_ctl->avail->beg->next; cur != el_ctl->avail->end; cur = cur->next){
+    if(cur->size >= size && (found == NULL || cur > found)){
+      found = cur;
+    }
+  }
+  return found;
+}
+
 // REQUIRED
 // Set the pointed to block to the given size and add a footer to
 // it. Creates another block above it by creating a new header and
@@ -329,6 +770,7 @@ el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size) {
     // Set the footer for the new block
     el_blockfoot_t *new_foot = el_get_footer(new_block);
     new_foot->size = remaining_size;
+    PROBE4(el, split, block, new_size, new_block, remaining_size);
 
     // The caller is responsible for managing the block lists
     return new_block;
@@ -336,6 +778,54 @@ el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size) {
 
 
 
+// Stamp a block that is about to be used with its lifetime and the
+// allocation clock so that el_free() can learn how long it lived.
+static void el_stamp_block(el_blockhead_t *block, char lifetime){
+  block->state = EL_USED;
+  block->lifetime = lifetime;
+  block->flags = 0;
+  block->birth = el_ctl->clock++;
+}
+
+// Use the bottom nbytes of the available block for a new allocation,
+// splitting off the remainder above it as a new available
+// block. Returns the pointer to the usable space of the block.
+static void *el_use_block_low(el_blockhead_t *block, size_t nbytes, char lifetime){
+    // Mark the allocated block as used before attempting to split
+    el_stamp_block(block, lifetime);
+    el_remove_block(el_ctl->avail, block);
+
+    // Attempt to split the block if there is enough space remaining after the allocation
+    el_blockhead_t *new_block = el_split_block(block, nbytes);
+    if (new_block) {
+        new_block->state = EL_AVAILABLE;
+        el_add_block_front(el_ctl->avail, new_block);
+    }
+
+    // Add the block to the used list after the split
+    el_add_block_front(el_ctl->used, block);
+
+    // Return a pointer to the usable space in the allocated block
+    return PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+}
+
+// Use the top nbytes of the available block for a new
+// allocation. The block is split so that its lower part remains
+// available and the upper part becomes the used block. If there is
+// not enough room to split, the whole block is used. Returns the
+// pointer to the usable space of the block.
+static void *el_use_block_high(el_blockhead_t *block, size_t nbytes, char lifetime){
+  el_remove_block(el_ctl->avail, block);
+  if(block->size > nbytes + EL_BLOCK_OVERHEAD){
+    el_blockhead_t *upper = el_split_block(block, block->size - nbytes - EL_BLOCK_OVERHEAD);
+    el_add_block_front(el_ctl->avail, block); // lower part stays available
+    block = upper;
+  }
+  el_stamp_block(block, lifetime);
+  el_add_block_front(el_ctl->used, block);
+  return PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+}
+
 // REQUIRED
 // Return pointer to a block of memory with at least the given size
 // for use by the user.  The pointer returned is to the usable space,
@@ -344,33 +834,153 @@ el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size) {
 // no space is available.
 
 void *el_malloc(size_t nbytes) {
+    PROBE3(el, malloc_entry, nbytes, EL_LIFETIME_LONG, el_ctl->avail->length);
+
     // return NULL if requested size is zero or exceeds the maximum allowable allocation size
-    if (nbytes == 0 || nbytes + EL_BLOCK_OVERHEAD > el_ctl->heap_bytes) {
+    if (nbytes == 0 || (nbytes + EL_BLOCK_OVERHEAD > el_ctl->heap_bytes && el_grow_for(nbytes) != 0)) {
+        PROBE4(el, malloc_return, nbytes, NULL, el_ctl->avail->length, el_ctl->used->length);
         return NULL;
     }
 
     // find the first available block that is large enough to accommodate the requested size
     el_blockhead_t *block = el_find_first_avail(nbytes);
+    if (!block && el_grow_for(nbytes) == 0) {
+        block = el_find_first_avail(nbytes); // heap grew on demand
+    }
     if (!block) {
+        PROBE4(el, malloc_return, nbytes, NULL, el_ctl->avail->length, el_ctl->used->length);
         return NULL; // No suitable block found
     }
 
-    // Mark the allocated block as used before attempting to split
-    block->state = EL_USED;
-    el_remove_block(el_ctl->avail, block);
+    void *ptr = el_use_block_low(block, nbytes, EL_LIFETIME_LONG);
+    EL_PROF_CHECK(ptr, nbytes);
+    el_prefault_check();
+    PROBE4(el, malloc_return, nbytes, ptr, el_ctl->avail->length, el_ctl->used->length);
+    return ptr;
+}
 
-    // Attempt to split the block if there is enough space remaining after the allocation
-    el_blockhead_t *new_block = el_split_block(block, nbytes);
-    if (new_block) {
-        new_block->state = EL_AVAILABLE;
-        el_add_block_front(el_ctl->avail, new_block);
+// Like el_malloc() but places the block according to its expected
+// lifetime. EL_LIFETIME_LONG blocks go in the lowest available block
+// that fits and are split off its bottom. EL_LIFETIME_SHORT blocks go
+// in the highest available block that fits and are split off its
+// top. Keeping the two apart means short-lived blocks coalesce with
+// one another into a large block at the top of the heap rather than
+// leaving small holes between long-lived blocks; el_trim_heap() can
+// then return that space. EL_LIFETIME_AUTO predicts the lifetime
+// with el_predict_lifetime().  Returns NULL if no space is available.
+void *el_malloc_hint(size_t nbytes, char lifetime){
+  PROBE3(el, malloc_entry, nbytes, lifetime, el_ctl->avail->length);
+  void *ptr = NULL;
+  if(nbytes == 0 || (nbytes + EL_BLOCK_OVERHEAD > el_ctl->heap_bytes && el_grow_for(nbytes) != 0)){
+    PROBE4(el, malloc_return, nbytes, NULL, el_ctl->avail->length, el_ctl->used->length);
+    return NULL;
+  }
+  if(lifetime == EL_LIFETIME_AUTO){
+    lifetime = el_predict_lifetime(nbytes);
+  }
+  if(lifetime == EL_LIFETIME_SHORT){
+    el_blockhead_t *block = el_find_highest_avail(nbytes);
+    if(block == NULL && el_grow_for(nbytes) == 0){
+      block = el_find_highest_avail(nbytes);
+    }
+    if(block != NULL){
+      ptr = el_use_block_high(block, nbytes, EL_LIFETIME_SHORT);
+    }
+  }
+  else{
+    el_blockhead_t *block = el_find_lowest_avail(nbytes);
+    if(block == NULL && el_grow_for(nbytes) == 0){
+      block = el_find_lowest_avail(nbytes);
+    }
+    if(block != NULL){
+      ptr = el_use_block_low(block, nbytes, EL_LIFETIME_LONG);
     }
+  }
+  EL_PROF_CHECK(ptr, nbytes);
+  el_prefault_check();
+  PROBE4(el, malloc_return, nbytes, ptr, el_ctl->avail->length, el_ctl->used->length);
+  return ptr;
+}
 
-    // Add the block to the used list after the split
-    el_add_block_front(el_ctl->used, block);
+// Use the first available block which can hold nbytes at an address
+// that is a multiple of alignment for el_malloc_aligned(). Returns
+// NULL if there is no such block.
+static void *el_use_aligned_first_fit(size_t alignment, size_t nbytes){
+  for(el_blockhead_t *block = el_ctl->avail->beg->next; block != el_ctl->avail->end; block = block->next){
+    size_t user = (size_t) PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+    size_t aligned = (user + alignment - 1) & ~(alignment - 1);
+    while(aligned != user && aligned - user < EL_BLOCK_OVERHEAD){
+      aligned += alignment;             // leave room for the header/footer of the gap block
+    }
+    size_t gap = aligned - user;
+    if(block->size < gap || block->size - gap < nbytes){
+      continue;
+    }
+    if(gap > 0){
+      el_remove_block(el_ctl->avail, block);
+      el_blockhead_t *upper = el_split_block(block, gap - EL_BLOCK_OVERHEAD);
+      upper->state = EL_AVAILABLE;
+      el_add_block_front(el_ctl->avail, block);
+      el_add_block_front(el_ctl->avail, upper);
+      block = upper;
+    }
+    return el_use_block_low(block, nbytes, EL_LIFETIME_LONG);
+  }
+  return NULL;
+}
 
-    // Return a pointer to the usable space in the allocated block
-    return PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+// Return pointer to at least nbytes of usable space whose address is
+// a multiple of alignment, which must be a power of 2. Blocks
+// returned by el_malloc() are only aligned as well as the sizes of
+// the blocks below them so callers storing types that need alignment
+// should use this function. The first available block which can hold
+// an aligned area is used: any space below the aligned area is split
+// off as an available block of its own which requires a gap of at
+// least EL_BLOCK_OVERHEAD, and the remainder above is split off as
+// in el_malloc(). Returns NULL if alignment is not a power of 2 or no
+// space is available. The block is freed with el_free().
+void *el_malloc_aligned(size_t alignment, size_t nbytes){
+  if(alignment <= 1){
+    return el_malloc(nbytes);
+  }
+  PROBE3(el, malloc_entry, nbytes, EL_LIFETIME_LONG, el_ctl->avail->length);
+  if((alignment & (alignment-1)) != 0 || nbytes == 0){
+    PROBE4(el, malloc_return, nbytes, NULL, el_ctl->avail->length, el_ctl->used->length);
+    return NULL;
+  }
+  void *ptr = NULL;
+  if(nbytes + EL_BLOCK_OVERHEAD <= el_ctl->heap_bytes){
+    ptr = el_use_aligned_first_fit(alignment, nbytes);
+  }
+  if(ptr == NULL && el_grow_for(nbytes + alignment) == 0){
+    ptr = el_use_aligned_first_fit(alignment, nbytes);
+  }
+  EL_PROF_CHECK(ptr, nbytes);
+  el_prefault_check();
+  PROBE4(el, malloc_return, nbytes, ptr, el_ctl->avail->length, el_ctl->used->length);
+  return ptr;
+}
+
+// Return the lifetime size class of a block of the given size which
+// is the position of its highest set bit.
+int el_size_class(size_t size){
+  if(size == 0){
+    return 0;
+  }
+  return (int) (sizeof(size_t)*8 - 1 - __builtin_clzl(size));
+}
+
+// Predict whether a block of the given size will be short- or
+// long-lived based on how long blocks of the same size class lived
+// before being freed. Returns EL_LIFETIME_SHORT if most recently
+// freed blocks of the class were short-lived and EL_LIFETIME_LONG
+// otherwise, including when there is no history for the class.
+char el_predict_lifetime(size_t size){
+  el_lifestat_t *stat = &el_ctl->lifestats[el_size_class(size)];
+  if(stat->short_frees > stat->long_frees){
+    return EL_LIFETIME_SHORT;
+  }
+  return EL_LIFETIME_LONG;
 }
 
 
@@ -407,6 +1017,7 @@ void el_merge_block_with_above(el_blockhead_t *lower) {
         // update the footer of the merged block to reflect the new size
         el_blockfoot_t *footer = el_get_footer(lower);
         footer->size = lower->size;
+        PROBE3(el, merge, lower, higher, lower->size);
 
         // add the merged block (lower) back to the front of the available list
         el_add_block_front(el_ctl->avail, lower);
@@ -416,6 +1027,25 @@ void el_merge_block_with_above(el_blockhead_t *lower) {
 
 
 
+// Record how long the given used block lived in the history for its
+// size class. Blocks freed within EL_SHORT_LIFETIME allocations count
+// as short-lived. Counts are halved once they grow large so that
+// recent behavior dominates the prediction.
+static void el_learn_lifetime(el_blockhead_t *block){
+  el_lifestat_t *stat = &el_ctl->lifestats[el_size_class(block->size)];
+  uint32_t age = el_ctl->clock - block->birth;
+  if(age <= EL_SHORT_LIFETIME){
+    stat->short_frees++;
+  }
+  else{
+    stat->long_frees++;
+  }
+  if(stat->short_frees + stat->long_frees >= 256){
+    stat->short_frees /= 2;
+    stat->long_frees /= 2;
+  }
+}
+
 // REQUIRED
 // Free the block pointed to by the give ptr.  The area immediately
 // preceding the pointer should contain an el_blockhead_t with information
@@ -426,11 +1056,17 @@ void el_free(void *ptr) {
     if (!ptr) return;
 
     el_blockhead_t *block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+    PROBE4(el, free, ptr, block->size, el_ctl->avail->length, el_ctl->used->length);
+    if (block->flags & EL_FLAG_SAMPLED) {
+        el_prof_retire(block);
+    }
+    el_learn_lifetime(block);
     block->state = EL_AVAILABLE;
 
-    // update the lists before merging
-    el_add_block_front(el_ctl->avail, block);
+    // update the lists before merging; the block must leave the used
+    // list before its links are reused for the available list
     el_remove_block(el_ctl->used, block);
+    el_add_block_front(el_ctl->avail, block);
 
     // attempt to merge with the block above
     el_merge_block_with_above(block);
@@ -464,15 +1100,37 @@ void el_free(void *ptr) {
 // below it. Returns 0 on success.
 
 int el_append_pages_to_heap(int npages) {
-    size_t additional_bytes = npages * EL_PAGE_BYTES;
-    void *new_heap_end = mmap(el_ctl->heap_end, additional_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-
-    // Check if mmap failed or the new heap end is not equal to the current heap end
-    if (new_heap_end == MAP_FAILED || new_heap_end != el_ctl->heap_end) {
+    int ret = 0;
+    size_t additional_bytes = (size_t) npages * EL_PAGE_BYTES;
+    if (npages <= 0) {
       printf("ERROR: Unable to mmap() additional %d pages\n",npages);
         return 1;
     }
 
+    // pages already mapped and faulted in at heap_end by the prefault thread
+    size_t staged_bytes = el_prefault_take();
+    if (staged_bytes >= additional_bytes) {
+        additional_bytes = staged_bytes;
+    }
+    else {
+        void *want = PTR_PLUS_BYTES(el_ctl->heap_end, staged_bytes);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (el_ctl->prefault_mode == EL_PREFAULT_POPULATE) {
+            flags |= MAP_POPULATE;
+        }
+        void *new_heap_end = mmap(want, additional_bytes - staged_bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        // Check if mmap failed or the new heap end is not equal to the current heap end
+        if (new_heap_end == MAP_FAILED || new_heap_end != want) {
+          printf("ERROR: Unable to mmap() additional %d pages\n",npages);
+            if (staged_bytes == 0) {
+                return 1;
+            }
+            additional_bytes = staged_bytes; // still add the prefaulted pages
+            ret = 1;
+        }
+    }
+
     // Initialize the new block at the current heap end
     el_blockhead_t *new_block = (el_blockhead_t *)el_ctl->heap_end;
     new_block->size = additional_bytes - EL_BLOCK_OVERHEAD;
@@ -486,6 +1144,7 @@ int el_append_pages_to_heap(int npages) {
     // update heap end and total bytes
     el_ctl->heap_end = PTR_PLUS_BYTES(el_ctl->heap_end, additional_bytes);
     el_ctl->heap_bytes += additional_bytes;
+    PROBE3(el, heap_grow, additional_bytes / EL_PAGE_BYTES, new_block, el_ctl->heap_bytes);
 
     // merge with adjacent blocks if possible
     el_blockhead_t *block_below = el_block_below(new_block);
@@ -493,7 +1152,419 @@ int el_append_pages_to_heap(int npages) {
         el_merge_block_with_above(block_below);
     }
 
+    return ret;
+}
+
+// Return whole pages at the top of the heap to the operating system
+// with munmap() if the highest block in the heap is available. The
+// block is shrunk to end at the new heap end; the heap is never made
+// smaller than EL_HEAP_INITIAL_SIZE. Most useful after short-lived
+// blocks, which el_malloc_hint() places at the top of the heap, have
+// been freed. Returns the number of bytes released.
+size_t el_trim_heap(){
+  el_prefault_discard();        // staged pages would no longer sit at heap_end
+  el_blockfoot_t *top_foot = PTR_MINUS_BYTES(el_ctl->heap_end, sizeof(el_blockfoot_t));
+  el_blockhead_t *top = el_get_header(top_foot);
+  if(top->state != EL_AVAILABLE){
+    return 0;
+  }
+
+  // lowest page boundary that still leaves room for the top block's header/footer
+  size_t keep = PTR_MINUS_PTR(top, el_ctl->heap_start) + EL_BLOCK_OVERHEAD;
+  keep = (keep + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES * EL_PAGE_BYTES;
+  if(keep < EL_HEAP_INITIAL_SIZE){
+    keep = EL_HEAP_INITIAL_SIZE;
+  }
+  if(keep >= el_ctl->heap_bytes){
     return 0;
+  }
+
+  size_t released = el_ctl->heap_bytes - keep;
+  void *new_end = PTR_PLUS_BYTES(el_ctl->heap_start, keep);
+  el_remove_block(el_ctl->avail, top);
+  top->size -= released;
+  el_get_footer(top)->size = top->size;
+  el_add_block_front(el_ctl->avail, top);
+
+  munmap(new_end, released);
+  el_ctl->heap_end = new_end;
+  el_ctl->heap_bytes = keep;
+  PROBE2(el, heap_trim, released, el_ctl->heap_bytes);
+  return released;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HEAP PREFAULTING
+//
+// The first write to each freshly mapped page faults into the kernel
+// which puts page fault latency on the allocation that first touches
+// new heap space. With el_set_prefault() the heap instead grows ahead
+// of demand once the bytes in the available list fall below a
+// watermark, with the new pages faulted in before they are used:
+//
+// EL_PREFAULT_POPULATE: the allocation that crosses the watermark
+// appends pages mapped with MAP_POPULATE so the kernel faults them all
+// in at once instead of one fault per page later.
+//
+// EL_PREFAULT_THREAD: crossing the watermark asks a background thread
+// to map the next pages at heap_end and touch each of them. A later
+// el_append_pages_to_heap(), either from the next allocation below the
+// watermark or from one which does not fit, adopts the staged pages
+// without faulting. The background thread only works on the staged
+// pages; the heap itself is only changed by the allocating thread.
+//
+// In both modes an allocation which does not fit grows the heap
+// rather than failing.
+
+// State shared with the prefault thread, protected by lock.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          // signaled when want, staging, ready or stop change
+  pthread_t thread;
+  int running;                  // 1 if the thread was started
+  int stop;                     // asks the thread to exit
+  int want;                     // a chunk has been requested at target
+  int staging;                  // the thread is mapping a chunk
+  int ready;                    // a mapped chunk is at staged
+  void *target;                 // address to map the requested chunk at
+  void *staged;                 // address of the ready chunk
+  size_t bytes;                 // size of the requested or ready chunk
+} el_pf = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Background thread for EL_PREFAULT_THREAD: waits for a request then
+// maps the pages at the requested address and touches each of them.
+static void *el_prefault_main(void *arg){
+  pthread_mutex_lock(&el_pf.lock);
+  while(1){
+    while(!el_pf.want && !el_pf.stop){
+      pthread_cond_wait(&el_pf.cond, &el_pf.lock);
+    }
+    if(el_pf.stop){
+      break;
+    }
+    void *target = el_pf.target;
+    size_t bytes = el_pf.bytes;
+    el_pf.want = 0;
+    el_pf.staging = 1;
+    pthread_mutex_unlock(&el_pf.lock);
+
+    void *pages = mmap(target, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(pages != MAP_FAILED && pages != target){
+      munmap(pages, bytes);
+      pages = MAP_FAILED;
+    }
+    if(pages != MAP_FAILED){
+      for(size_t off=0; off<bytes; off+=EL_PAGE_BYTES){
+        ((volatile char *) pages)[off] = 0;
+      }
+    }
+
+    pthread_mutex_lock(&el_pf.lock);
+    el_pf.staging = 0;
+    if(pages != MAP_FAILED){
+      el_pf.staged = pages;
+      el_pf.ready = 1;
+    }
+    pthread_cond_broadcast(&el_pf.cond);
+  }
+  pthread_mutex_unlock(&el_pf.lock);
+  return NULL;
 }
 
+// Wait for any requested or in progress chunk and return the number
+// of bytes of prefaulted pages mapped at heap_end, handing them over
+// to the caller which must add them to the heap. Returns 0 if there
+// are none.
+static size_t el_prefault_take(){
+  if(!el_pf.running){
+    return 0;
+  }
+  size_t bytes = 0;
+  pthread_mutex_lock(&el_pf.lock);
+  while(el_pf.want || el_pf.staging){
+    pthread_cond_wait(&el_pf.cond, &el_pf.lock);
+  }
+  if(el_pf.ready && el_pf.staged == el_ctl->heap_end){
+    bytes = el_pf.bytes;
+  }
+  else if(el_pf.ready){
+    munmap(el_pf.staged, el_pf.bytes);
+  }
+  el_pf.ready = 0;
+  pthread_mutex_unlock(&el_pf.lock);
+  return bytes;
+}
 
+// Unmap any prefaulted pages that have not been added to the heap.
+static void el_prefault_discard(){
+  size_t bytes = el_prefault_take();
+  if(bytes > 0){
+    munmap(el_ctl->heap_end, bytes);
+  }
+}
+
+// Called after each allocation: when prefaulting is on and the
+// available bytes have fallen below the watermark, grow the heap with
+// pages that are already faulted in or ask the prefault thread for
+// more.
+static void el_prefault_check(){
+  if(el_ctl->prefault_mode == EL_PREFAULT_OFF ||
+     el_ctl->avail->bytes >= el_ctl->prefault_watermark)
+  {
+    return;
+  }
+  if(el_ctl->prefault_mode == EL_PREFAULT_POPULATE){
+    el_append_pages_to_heap(el_ctl->prefault_pages);
+    return;
+  }
+  pthread_mutex_lock(&el_pf.lock);
+  int ready = el_pf.ready;
+  if(!ready && !el_pf.want && !el_pf.staging){
+    el_pf.want = 1;
+    el_pf.target = el_ctl->heap_end;
+    el_pf.bytes = (size_t) el_ctl->prefault_pages * EL_PAGE_BYTES;
+    pthread_cond_broadcast(&el_pf.cond);
+  }
+  pthread_mutex_unlock(&el_pf.lock);
+  if(ready){
+    el_append_pages_to_heap(el_ctl->prefault_pages); // adopts the staged pages
+  }
+}
+
+// Grow the heap so that an allocation of nbytes which did not fit
+// will. Only done when prefaulting is on; returns 1 without growing
+// otherwise so that el_malloc() fails as usual. Returns 0 on success.
+static int el_grow_for(size_t nbytes){
+  if(el_ctl->prefault_mode == EL_PREFAULT_OFF){
+    return 1;
+  }
+  size_t pages = (nbytes + 2*EL_BLOCK_OVERHEAD + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES;
+  if(pages < (size_t) el_ctl->prefault_pages){
+    pages = el_ctl->prefault_pages;
+  }
+  return el_append_pages_to_heap((int) pages);
+}
+
+// Set how the heap grows ahead of demand. mode is one of
+// EL_PREFAULT_OFF, EL_PREFAULT_POPULATE or EL_PREFAULT_THREAD; for the
+// latter two, once the bytes in the available list fall below
+// watermark the heap grows by npages pages that are faulted in ahead
+// of use. EL_PREFAULT_THREAD starts a background thread which is
+// stopped when the mode changes or in el_cleanup(). Returns 0 on
+// success and 1 if the arguments are invalid or the thread can't be
+// started in which case prefaulting is off.
+int el_set_prefault(int mode, size_t watermark, int npages){
+  if(el_pf.running){
+    pthread_mutex_lock(&el_pf.lock);
+    el_pf.stop = 1;
+    pthread_cond_broadcast(&el_pf.cond);
+    pthread_mutex_unlock(&el_pf.lock);
+    pthread_join(el_pf.thread, NULL);
+    el_pf.running = 0;
+    el_pf.stop = 0;
+    el_pf.want = 0;
+    if(el_pf.ready){
+      munmap(el_pf.staged, el_pf.bytes);
+      el_pf.ready = 0;
+    }
+  }
+  el_ctl->prefault_mode = EL_PREFAULT_OFF;
+  el_ctl->prefault_watermark = 0;
+  el_ctl->prefault_pages = 0;
+  if(mode == EL_PREFAULT_OFF){
+    return 0;
+  }
+  if((mode != EL_PREFAULT_POPULATE && mode != EL_PREFAULT_THREAD) || npages <= 0){
+    return 1;
+  }
+  if(mode == EL_PREFAULT_THREAD){
+    if(pthread_create(&el_pf.thread, NULL, el_prefault_main, NULL) != 0){
+      return 1;
+    }
+    el_pf.running = 1;
+  }
+  el_ctl->prefault_mode = mode;
+  el_ctl->prefault_watermark = watermark;
+  el_ctl->prefault_pages = npages;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RELOCATABLE HANDLES AND HEAP COMPACTION
+//
+// Blocks allocated with el_halloc() are referred to by a handle rather
+// than an address so the allocator may move them. The memory of a
+// handle block is accessed between el_hlock(), which returns its
+// current address, and el_hunlock(); while locked the block stays in
+// place. el_compact() slides all unlocked handle blocks down towards
+// the start of the heap to close the holes between blocks which
+// leaves the free space as large blocks, in the best case a single
+// block at the top of the heap which el_trim_heap() can return.
+//
+// The first word of a handle block's usable space holds its handle
+// number so that compaction can find the handle table entry to
+// update; callers see the space after it.
+
+// Entry in the handle table; entries not in use are chained through
+// next_free.
+typedef struct {
+  el_blockhead_t *block;        // current location of the block, NULL if unused
+  int locks;                    // number of el_hlock() calls not yet unlocked
+  el_handle_t next_free;        // next unused entry
+} el_handle_entry_t;
+
+// Table of handles; handle h is entry h and entry 0 is never used so
+// that EL_NO_HANDLE is 0.
+static struct {
+  el_handle_entry_t *entries;
+  el_handle_t cap;              // number of entries
+  el_handle_t free_list;        // first unused entry, EL_NO_HANDLE if none
+} el_handles = {0};
+
+// Release the handle table; done in el_cleanup().
+static void el_handles_free(){
+  free(el_handles.entries);
+  memset(&el_handles, 0, sizeof(el_handles));
+}
+
+// Return the table entry for a handle or NULL if it is not in use.
+static el_handle_entry_t *el_handle_entry(el_handle_t h){
+  if(h <= 0 || h >= el_handles.cap || el_handles.entries[h].block == NULL){
+    return NULL;
+  }
+  return &el_handles.entries[h];
+}
+
+// Allocate a relocatable block of at least nbytes and return its
+// handle. If no block is available the heap is compacted and the
+// allocation retried. Returns EL_NO_HANDLE if there is no space.
+el_handle_t el_halloc(size_t nbytes){
+  if(el_handles.free_list == EL_NO_HANDLE){
+    el_handle_t cap = el_handles.cap == 0 ? 64 : el_handles.cap*2;
+    el_handle_entry_t *entries = realloc(el_handles.entries, cap*sizeof(el_handle_entry_t));
+    if(entries == NULL){
+      return EL_NO_HANDLE;
+    }
+    for(el_handle_t h = cap-1; h >= el_handles.cap && h > 0; h--){
+      entries[h] = (el_handle_entry_t) {NULL, 0, el_handles.free_list};
+      el_handles.free_list = h;
+    }
+    entries[0] = (el_handle_entry_t) {NULL, 0, EL_NO_HANDLE};
+    el_handles.entries = entries;
+    el_handles.cap = cap;
+  }
+
+  size_t *ptr = el_malloc(nbytes + sizeof(size_t));
+  if(ptr == NULL && el_compact() > 0){
+    ptr = el_malloc(nbytes + sizeof(size_t));
+  }
+  if(ptr == NULL){
+    return EL_NO_HANDLE;
+  }
+
+  el_handle_t h = el_handles.free_list;
+  el_handle_entry_t *entry = &el_handles.entries[h];
+  el_handles.free_list = entry->next_free;
+  entry->block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  entry->locks = 0;
+  entry->block->flags |= EL_FLAG_HANDLE;
+  *ptr = h;
+  return h;
+}
+
+// Lock the block of a handle in place and return the address of its
+// usable space which stays valid until the matching el_hunlock().
+// Locks nest. Returns NULL for an invalid handle.
+void *el_hlock(el_handle_t h){
+  el_handle_entry_t *entry = el_handle_entry(h);
+  if(entry == NULL){
+    return NULL;
+  }
+  entry->locks++;
+  return PTR_PLUS_BYTES(entry->block, sizeof(el_blockhead_t) + sizeof(size_t));
+}
+
+// Undo one el_hlock() of a handle; once all locks are undone the
+// block may be moved by el_compact().
+void el_hunlock(el_handle_t h){
+  el_handle_entry_t *entry = el_handle_entry(h);
+  if(entry != NULL && entry->locks > 0){
+    entry->locks--;
+  }
+}
+
+// Free the block of a handle and the handle itself.
+void el_hfree(el_handle_t h){
+  el_handle_entry_t *entry = el_handle_entry(h);
+  if(entry == NULL){
+    return;
+  }
+  el_free(PTR_PLUS_BYTES(entry->block, sizeof(el_blockhead_t)));
+  entry->block = NULL;
+  entry->locks = 0;
+  entry->next_free = el_handles.free_list;
+  el_handles.free_list = h;
+}
+
+// Turn the total bytes of heap starting at block into a single
+// available block and add it to the available list.
+static void el_make_avail_block(el_blockhead_t *block, size_t total){
+  block->size = total - EL_BLOCK_OVERHEAD;
+  block->state = EL_AVAILABLE;
+  el_get_footer(block)->size = block->size;
+  el_add_block_front(el_ctl->avail, block);
+}
+
+// Compact the heap by walking its blocks from the bottom with
+// el_block_above() and sliding each unlocked handle block down over
+// the available blocks below it. Blocks from el_malloc() and locked
+// handle blocks stay in place; the free space gathered below each of
+// them becomes a single available block. The free space above the
+// last fixed block becomes one available block at the top of the heap
+// which el_trim_heap() can release. Returns the number of bytes moved.
+size_t el_compact(){
+  PROBE2(el, compact_entry, el_ctl->avail->length, el_ctl->avail->bytes);
+  size_t moved = 0;
+  el_blockhead_t *gap = NULL;   // start of free space gathered so far, NULL if none
+  el_blockhead_t *cur = el_ctl->heap_start;
+  while(cur != NULL){
+    el_blockhead_t *above = el_block_above(cur);
+    if(cur->state == EL_AVAILABLE){
+      el_remove_block(el_ctl->avail, cur);
+      if(gap == NULL){
+        gap = cur;
+      }
+    }
+    else if(gap != NULL && (cur->flags & EL_FLAG_HANDLE) &&
+            el_handles.entries[*(size_t *) PTR_PLUS_BYTES(cur, sizeof(el_blockhead_t))].locks == 0)
+    {
+      // slide the block down to the start of the gap; the used list
+      // neighbors must point at its new location
+      size_t total = cur->size + EL_BLOCK_OVERHEAD;
+      el_handle_t h = *(size_t *) PTR_PLUS_BYTES(cur, sizeof(el_blockhead_t));
+      memmove(gap, cur, total);
+      gap->prev->next = gap;
+      gap->next->prev = gap;
+      el_handles.entries[h].block = gap;
+      if(gap->flags & EL_FLAG_SAMPLED){
+        el_prof_move(cur, gap);
+      }
+      moved += total;
+      gap = PTR_PLUS_BYTES(gap, total);
+    }
+    else if(gap != NULL){
+      el_make_avail_block(gap, PTR_MINUS_PTR(cur, gap)); // fixed block ends the gap
+      gap = NULL;
+    }
+    cur = above;
+  }
+  if(gap != NULL){
+    el_make_avail_block(gap, PTR_MINUS_PTR(el_ctl->heap_end, gap));
+  }
+  PROBE3(el, compact_return, moved, el_ctl->avail->length, el_ctl->avail->bytes);
+  return moved;
+}
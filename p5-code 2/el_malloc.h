@@ -8,6 +8,10 @@
 #include <sys/mman.h>
 #include <assert.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // macro to add a byte offset to a pointer, arguments are a pointer
 // and a # of bytes (usually size_t)
 #define PTR_PLUS_BYTES(ptr,off) ((void *) (((size_t) (ptr)) + ((size_t) (off))))
@@ -33,6 +37,42 @@
 #define EL_END_BLOCK     'E'    // block state indicating dummy ending node in a list
 #define EL_UNINITIALIZED  0     // indication of uninitialized data
 
+// lifetime hints for el_malloc_hint(); long-lived blocks are placed
+// at low addresses in the heap while short-lived blocks are carved
+// off the top of the heap so that they coalesce with one another and
+// the heap can be trimmed once they are freed
+#define EL_LIFETIME_LONG  'l'   // long-lived block, placed low in the heap
+#define EL_LIFETIME_SHORT 's'   // short-lived block, placed high in the heap
+#define EL_LIFETIME_AUTO  '?'   // predict lifetime from past frees of the same size class
+
+// A block freed within this many allocations of its own allocation
+// counts as short-lived when learning per size class lifetimes.
+#define EL_SHORT_LIFETIME 64
+
+// Number of size classes for lifetime prediction; class i holds
+// blocks of size [2^i, 2^(i+1)) bytes.
+#define EL_SIZE_CLASSES 64
+
+// modes for el_set_prefault()
+#define EL_PREFAULT_OFF      0  // heap only grows through el_append_pages_to_heap()
+#define EL_PREFAULT_POPULATE 1  // grow ahead of demand with MAP_POPULATE in the allocating thread
+#define EL_PREFAULT_THREAD   2  // a background thread maps and faults in the next pages
+
+// flags for used blocks
+#define EL_FLAG_SAMPLED   0x01  // block was sampled by the heap profiler
+#define EL_FLAG_HANDLE    0x02  // block belongs to a handle and may be moved by el_compact()
+
+// Handle to a relocatable block from el_halloc()
+typedef int el_handle_t;
+#define EL_NO_HANDLE 0          // handle value indicating failure
+
+// Limits and output formats for the sampling heap profiler
+#define EL_PROF_MAX_DEPTH 32    // deepest call stack recorded for an allocation site
+#define EL_PROF_MAX_SITES 4096  // most distinct allocation sites tracked
+#define EL_PROF_FOLDED_LIVE  0  // folded stacks weighted by live bytes
+#define EL_PROF_FOLDED_TOTAL 1  // folded stacks weighted by all bytes ever allocated
+#define EL_PROF_PPROF        2  // legacy gperftools heap profile read by pprof
+
 // type which is a "header" for a block of memory; containts info on
 // size, whether the block is available or in use, and links to the
 // next/prev blocks in a doubly linked list. This data structure
@@ -41,6 +81,9 @@
 typedef struct block {
   size_t size;                  // number of bytes of memory in this block
   char state;                   // either EL_AVAILABLE or EL_USED
+  char lifetime;                // EL_LIFETIME_LONG or EL_LIFETIME_SHORT for used blocks
+  char flags;                   // EL_FLAG_* bits for used blocks
+  uint32_t birth;               // value of el_ctl->clock when the block was allocated
   struct block *next;           // pointer to next block in same list
   struct block *prev;           // pointer to previous block in same list
 } el_blockhead_t;
@@ -71,6 +114,15 @@ typedef struct {
 } el_blocklist_t;
 // NOTE: total available bytes for use/in-use in the list is (bytes - length*EL_BLOCK_OVERHEAD)
 
+// Per size class counts of how many freed blocks lived a short or
+// long time; used to predict the lifetime of EL_LIFETIME_AUTO
+// allocations. Counts are halved periodically so that the prediction
+// follows changes in program behavior.
+typedef struct {
+  uint32_t short_frees;         // blocks freed within EL_SHORT_LIFETIME allocations
+  uint32_t long_frees;          // blocks that lived longer
+} el_lifestat_t;
+
 // Type for the global control of the allocator. Tracks heap size,
 // start and end addresses, total size, and lists of available and
 // used blocks.
@@ -82,6 +134,11 @@ typedef struct {
   el_blocklist_t used_actual;   // space for the used list data
   el_blocklist_t *avail;        // pointer to avail_actual
   el_blocklist_t *used;         // pointer to used_actual
+  uint32_t clock;               // number of allocations made, used to age blocks
+  el_lifestat_t lifestats[EL_SIZE_CLASSES]; // lifetime history for each size class
+  int prefault_mode;            // EL_PREFAULT_* mode for growing the heap ahead of demand
+  int prefault_pages;           // pages added each time the heap grows ahead of demand
+  size_t prefault_watermark;    // grow once available bytes fall below this
 } el_ctl_t;
 
 // global control declared in el_malloc.c
@@ -103,12 +160,35 @@ void el_add_block_front(el_blocklist_t *list, el_blockhead_t *block);
 void el_remove_block(el_blocklist_t *list, el_blockhead_t *block);
 
 el_blockhead_t *el_find_first_avail(size_t size);
+el_blockhead_t *el_find_lowest_avail(size_t size);
+el_blockhead_t *el_find_highest_avail(size_t size);
 el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size);
 el_blockhead_t *el_allocate_block(size_t size);
 void *el_malloc(size_t nbytes);
+void *el_malloc_hint(size_t nbytes, char lifetime);
+void *el_malloc_aligned(size_t alignment, size_t nbytes);
+int el_size_class(size_t size);
+char el_predict_lifetime(size_t size);
 
 void el_merge_block_with_above(el_blockhead_t *lower);
 void el_free(void *ptr);
 
 int el_append_pages_to_heap(int npages);
+size_t el_trim_heap();
+int el_set_prefault(int mode, size_t watermark, int npages);
+
+el_handle_t el_halloc(size_t nbytes);
+void *el_hlock(el_handle_t h);
+void el_hunlock(el_handle_t h);
+void el_hfree(el_handle_t h);
+size_t el_compact();
+
+int  el_prof_start(size_t sample_bytes);
+void el_prof_stop();
+void el_prof_print_stats();
+int  el_prof_dump(FILE *out, int format);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
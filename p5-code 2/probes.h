@@ -0,0 +1,50 @@
+#ifndef PROBES_H
+#define PROBES_H 1
+
+// Static tracepoints for tracing el_malloc and sumdiag with perf,
+// bpftrace or systemtap without rebuilding. When <sys/sdt.h> is
+// available (Debian/Ubuntu: systemtap-sdt-dev, Fedora:
+// systemtap-sdt-devel) each PROBEn() compiles to a single nop plus an
+// ELF note describing the probe location and its arguments; attaching
+// a tracer patches the nop at run time. Without the header, or when
+// built with -DNO_PROBES, the probes compile to nothing.
+//
+// List the probes in a binary with
+//   > readelf -n ./test_el_malloc | grep -A2 stapsdt
+//   > sudo bpftrace -l 'usdt:./sumdiag_benchmark:*'
+// and trace one with, e.g.,
+//   > sudo bpftrace -e 'usdt:./el_demo:el:malloc_return { @[arg0] = count(); }'
+//
+// When the probes are compiled in their arguments are evaluated at
+// every probe site whether or not a tracer is attached, and without
+// the header they are not evaluated at all. Arguments must therefore
+// be cheap expressions, such as loads of values already at hand, with
+// no side effects. Anything costly to compute would need to be gated
+// on the probe's semaphore, which none of the probes here require.
+
+#if !defined(NO_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define PROBES_ENABLED 1
+# endif
+#endif
+
+#ifdef PROBES_ENABLED
+# define PROBE0(prov,name)                    STAP_PROBE(prov,name)
+# define PROBE1(prov,name,a1)                 STAP_PROBE1(prov,name,a1)
+# define PROBE2(prov,name,a1,a2)              STAP_PROBE2(prov,name,a1,a2)
+# define PROBE3(prov,name,a1,a2,a3)           STAP_PROBE3(prov,name,a1,a2,a3)
+# define PROBE4(prov,name,a1,a2,a3,a4)        STAP_PROBE4(prov,name,a1,a2,a3,a4)
+# define PROBE5(prov,name,a1,a2,a3,a4,a5)     STAP_PROBE5(prov,name,a1,a2,a3,a4,a5)
+# define PROBE6(prov,name,a1,a2,a3,a4,a5,a6)  STAP_PROBE6(prov,name,a1,a2,a3,a4,a5,a6)
+#else
+# define PROBE0(prov,name)                    do{}while(0)
+# define PROBE1(prov,name,a1)                 do{}while(0)
+# define PROBE2(prov,name,a1,a2)              do{}while(0)
+# define PROBE3(prov,name,a1,a2,a3)           do{}while(0)
+# define PROBE4(prov,name,a1,a2,a3,a4)        do{}while(0)
+# define PROBE5(prov,name,a1,a2,a3,a4,a5)     do{}while(0)
+# define PROBE6(prov,name,a1,a2,a3,a4,a5,a6)  do{}while(0)
+#endif
+
+#endif
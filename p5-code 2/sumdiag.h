@@ -7,12 +7,21 @@
 #include <assert.h>
 #include <math.h>
 #include <pthread.h>            // anticipating threading
+#include <stdint.h>
 
 
+// Layouts of matrix_t data; see sumdiag_layout.c
+#define MATRIX_ROW_MAJOR  0     // data[r*cols + c], the default
+#define MATRIX_COL_MAJOR  1     // data[c*rows + r]
+#define MATRIX_DIAG_MAJOR 2     // each diagonal contiguous, in output order
+#define MATRIX_TILED      3     // 16x16 tiles, Z order within each tile
+#define MATRIX_TILE_EDGE  16
+
 typedef struct {
   long rows;
   long cols;
   int *data;
+  int layout;                   // one of the MATRIX_ layouts above
 } matrix_t;
 
 typedef struct {
@@ -20,6 +29,7 @@ typedef struct {
   int *data;
 } vector_t;
 
+// MGET()/MSET() assume MATRIX_ROW_MAJOR; mget()/mset() handle any layout
 #define MGET(mat,i,j) ((mat).data[((i)*((mat).cols)) + (j)])
 #define VGET(vec,i)   ((vec).data[(i)])
 
@@ -46,12 +56,220 @@ void vset(vector_t *vec, int i, int x);
 void pb_srand(unsigned long seed);
 unsigned int pb_rand();
 void vector_fill_random(vector_t vec, int max);
-void matrix_fill_random(matrix_t mat, int max);
+int matrix_fill_random(matrix_t mat, int max);
 
 // sumdiag_base.c
 int sumdiag_BASE(matrix_t mat, vector_t vec);
 
 // sumdiag_optm.c
+#define SUMDIAG_PART_ROWS  0    // bands of rows into per-thread partial vectors
+#define SUMDIAG_PART_DIAGS 1    // ranges of whole diagonals
+#define SUMDIAG_PART_STEAL 2    // tiles balanced by work stealing
+#define SUMDIAG_PART_TILES 3    // cache blocked square tiles
+
+// Per worker counts from sumdiag_OPTM_steal()
+typedef struct {
+  long tiles;                   // tiles run including stolen ones
+  long steals;                  // tiles taken from other workers
+  long failed;                  // steal attempts finding the victim empty
+  double idle;                  // seconds without work before the reduction
+} steal_stats_t;
+
 int sumdiag_OPTM(matrix_t mat, vector_t vec, int thread_count);
+int sumdiag_OPTM_part(matrix_t mat, vector_t vec, int thread_count, int part);
+int sumdiag_OPTM_steal(matrix_t mat, vector_t vec, int thread_count,
+                       steal_stats_t *stats);
+void steal_stats_print(FILE *file, steal_stats_t *stats, int thread_count);
+long sumdiag_tile_size();
+void sumdiag_set_tile_size(long tile);
+
+// sumdiag_simd.c
+typedef void (*row_add_fn)(int *dst, const int *src, long n);
+typedef int (*row_sum_fn)(const int *src, long n);
+row_add_fn sumdiag_row_kernel();
+row_sum_fn sumdiag_row_sum_kernel();
+const char *sumdiag_simd_name();
+int sumdiag_ROWS(matrix_t mat, vector_t vec);
+
+// sumdiag_fused.c
+#define FUSED_DIAG 0x01         // diagonal sums as sumdiag_BASE()
+#define FUSED_ANTI 0x02         // anti-diagonal sums, element (r,c) in r+c
+#define FUSED_ROW  0x04         // row sums
+#define FUSED_COL  0x08         // column sums
+#define FUSED_ALL  0x0F
+
+typedef struct {
+  vector_t diag;                // rows+cols-1
+  vector_t anti;                // rows+cols-1
+  vector_t row;                 // rows
+  vector_t col;                 // cols
+} fused_out_t;
+
+int sumdiag_FUSED(matrix_t mat, int which, fused_out_t out, int thread_count);
+
+// sumdiag_reduce.c
+#define DIAG_SUM   0            // operators for diag_reduce()
+#define DIAG_MIN   1
+#define DIAG_MAX   2
+#define DIAG_COUNT 3
+#define DIAG_MEAN  4
+
+#define DIAG_ALL   0            // filters: every element,
+#define DIAG_ABOVE 1            // elements > threshold,
+#define DIAG_CALL  2            // elements where pred(x,arg) is nonzero
+
+typedef struct {
+  int op;                       // DIAG_SUM .. DIAG_MEAN
+  int filter;                   // DIAG_ALL, DIAG_ABOVE or DIAG_CALL
+  int threshold;                // for DIAG_ABOVE
+  int (*pred)(int x, void *arg);  // for DIAG_CALL
+  void *arg;
+} diag_op_t;
+
+int diag_reduce(matrix_t mat, diag_op_t op, vector_t out, double *mean, int thread_count);
+
+// sumdiag_typed.c: matrix_NAME_t and vector_NAME_t with elements of
+// type T for each X(NAME, T, RESULT) below along with init, free_data,
+// from_int and sumdiag_NAME() which sums into vector_RESULT_t.
+#define SUMDIAG_TYPES(X)                        \
+  X(i8,  int8_t,  i64)                          \
+  X(i16, int16_t, i64)                          \
+  X(i32, int32_t, i64)                          \
+  X(i64, int64_t, i64)                          \
+  X(f32, float,   f64)                          \
+  X(f64, double,  f64)
+
+#define SUMDIAG_DECLARE_TYPES(NAME, T, RESULT)                           \
+  typedef struct { long rows; long cols; T *data; } matrix_##NAME##_t;  \
+  typedef struct { long len; T *data; } vector_##NAME##_t;
+
+#define SUMDIAG_DECLARE_FUNCS(NAME, T, RESULT)                           \
+  int matrix_##NAME##_init(matrix_##NAME##_t *mat, long rows, long cols); \
+  void matrix_##NAME##_free_data(matrix_##NAME##_t *mat);               \
+  int vector_##NAME##_init(vector_##NAME##_t *vec, long len);           \
+  void vector_##NAME##_free_data(vector_##NAME##_t *vec);               \
+  void matrix_##NAME##_from_int(matrix_##NAME##_t mat, matrix_t src);   \
+  int sumdiag_##NAME(matrix_##NAME##_t mat, vector_##RESULT##_t vec, int thread_count);
+
+SUMDIAG_TYPES(SUMDIAG_DECLARE_TYPES)
+SUMDIAG_TYPES(SUMDIAG_DECLARE_FUNCS)
+
+// sumdiag_layout.c
+long matrix_data_len(long rows, long cols, int layout);
+long matrix_offset(matrix_t *mat, long r, long c);
+int matrix_convert(matrix_t src, matrix_t *dst, int layout, int thread_count);
+int sumdiag_LAYOUT(matrix_t mat, vector_t vec, int thread_count);
+
+// sumdiag_tracked.c
+typedef struct {
+  matrix_t mat;                 // private copy of the matrix
+  vector_t sums;                // diagonal sums of mat, always current
+} tracked_matrix_t;
+
+typedef struct {
+  long row;
+  long col;
+  int delta;                    // added to element (row,col)
+} cell_update_t;
+
+int tracked_init(tracked_matrix_t *tm, matrix_t mat, int thread_count);
+void tracked_free_data(tracked_matrix_t *tm);
+int tracked_get(tracked_matrix_t *tm, long r, long c);
+void tracked_set(tracked_matrix_t *tm, long r, long c, int x);
+int tracked_add_batch(tracked_matrix_t *tm, const cell_update_t *updates, long n);
+
+// sumdiag_stream.c
+int sumdiag_STREAM(FILE *file, long budget, vector_t *vec_ref, long *rows_ref, long *cols_ref);
+
+// sumdiag_binary.c
+#define SUMDIAG_BIN_VERSION  1
+#define SUMDIAG_BIN_HEADER   64         // bytes in the file header
+#define SUMDIAG_BIN_INT32    1          // element types
+#define SUMDIAG_BIN_MATRIX   0          // kinds of object in a file
+#define SUMDIAG_BIN_VECTOR   1
+#define SUMDIAG_MAP_POPULATE 1          // prefault all pages when mapping
+#define SUMDIAG_MAP_WILLNEED 2          // advise sequential readahead
+
+typedef struct {
+  void *base;                   // start of the mapped file
+  size_t len;                   // bytes mapped
+} matrix_map_t;
+
+int matrix_write_binary(char *fname, matrix_t mat, long alignment);
+int vector_write_binary(char *fname, vector_t vec, long alignment);
+int matrix_map_binary(char *fname, matrix_t *mat, matrix_map_t *map, int flags);
+int vector_map_binary(char *fname, vector_t *vec, matrix_map_t *map, int flags);
+void sumdiag_unmap(matrix_map_t *map);
+int sumdiag_is_binary(char *fname);
+void matrix_write_text(FILE *file, matrix_t mat);
+void vector_write_text(FILE *file, vector_t vec);
+
+// sumdiag_parse.c
+int sumdiag_parse_file(char *fname, int nheader, long *header, int **data_ref);
+
+// sumdiag_write.c
+#define SUMDIAG_WRITE_NOMEM  1          // no memory, nothing was written
+#define SUMDIAG_WRITE_FAILED 2          // a write failed, output may be partial
+
+int matrix_write_threads(FILE *file, matrix_t mat, int thread_count);
+int vector_write_buffered(FILE *file, vector_t vec);
+
+// sumdiag_batch.c
+int sumdiag_BATCH(matrix_t *mats, vector_t *vecs, long count, int thread_count);
+
+// sumdiag_procs.c
+int sumdiag_PROCS(char *path, int nprocs, vector_t *vec_ref, long *rows_ref, long *cols_ref);
+int matrix_to_shm(char *name, matrix_t mat, char *path, size_t path_len);
+
+// sumdiag_random.c
+unsigned long pb_skip(unsigned long s, unsigned long n);
+int matrix_fill_random_threads(matrix_t mat, int max, int thread_count);
+
+// sumdiag_narrow.c
+typedef struct {
+  long rows;
+  long cols;
+  int width;                    // bytes per element: 1, 2 or 4
+  void *data;                   // int8_t, int16_t or int32_t elements
+} narrow_matrix_t;
+
+int narrow_matrix_from(narrow_matrix_t *nmat, matrix_t mat);
+void narrow_matrix_free_data(narrow_matrix_t *nmat);
+int sumdiag_NARROW(narrow_matrix_t mat, vector_t vec, int thread_count);
+
+// sumdiag_sparse.c
+typedef struct {
+  long rows;
+  long cols;
+  long nnz;                     // number of stored nonzeros
+  long *row_ptr;                // rows+1 offsets of each row's nonzeros
+  long *col_idx;                // column of each nonzero
+  int *vals;                    // value of each nonzero
+} sparse_matrix_t;
+
+int sparse_from_csr(sparse_matrix_t *smat, long rows, long cols,
+                    const long *row_ptr, const long *col_idx, const int *vals);
+int sparse_from_coo(sparse_matrix_t *smat, long rows, long cols, long nnz,
+                    const long *row_idx, const long *col_idx, const int *vals);
+int sparse_from_dense(sparse_matrix_t *smat, matrix_t mat);
+int sparse_read_from_file(char *fname, sparse_matrix_t *smat);
+void sparse_free_data(sparse_matrix_t *smat);
+int sumdiag_SPARSE(sparse_matrix_t mat, vector_t vec, int thread_count);
+
+// sumdiag_pool.c
+typedef void (*pool_task_fn)(void *ctx, int id, int nworkers);
+int sumdiag_pool_init(int nthreads);
+void sumdiag_pool_shutdown();
+int sumdiag_pool_size();
+int sumdiag_pool_run(pool_task_fn task, void *ctx, int nworkers);
+void sumdiag_pool_barrier();
+void *sumdiag_pool_scratch(size_t bytes);
+void sumdiag_pool_share(long n, int id, int nworkers, long *beg, long *end);
+typedef void (*pool_merge_fn)(void *ctx, int dst, int src, int end, int nworkers);
+long sumdiag_pool_stride(long len);
+long sumdiag_pool_stride_of(long len, size_t size);
+void sumdiag_pool_tree(int id, int nworkers, pool_merge_fn merge, void *ctx);
+void sumdiag_pool_reduce(int *part, int *partials, long stride, long len,
+                         int id, int nworkers, row_add_fn add);
 
 #endif
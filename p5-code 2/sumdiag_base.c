@@ -5,6 +5,10 @@ int sumdiag_BASE_NORMAL(matrix_t mat, vector_t vec) {
     printf("sumdiag_base: bad sizes\n");
     return 1;
   }
+  if(mat.layout != MATRIX_ROW_MAJOR){               // MGET() below is row major
+    printf("sumdiag_base: bad layout\n");
+    return 1;
+  }
   for(int i=0; i<vec.len; i++){                    // initialize vector of diagonal sums
     VSET(vec,i,0);                                 // to all 0s
   }
@@ -0,0 +1,125 @@
+// sumdiag_batch.c: diagonal sums of many small matrices in one call.
+//
+// For a 4x4 to 64x64 matrix the work of sumdiag is a few hundred adds,
+// less than waking threads or even the loop setup of sumdiag_BASE().
+// sumdiag_BATCH() hands each pool worker a share of the matrices, each
+// summed whole on one thread so no partials or reductions are needed.
+//
+// Square row-major matrices of edge 4, 8, 16, 32 or 64 use kernels
+// specialised for that edge: each row is added into a local window of
+// the output with GCC vector types, 4 ints wide in the baseline
+// version and 8 with AVX2, and both loops are fully unrolled. The
+// project builds with -Og which ignores unroll pragmas, so the Makefile
+// compiles this file at -O2. Other sizes go through the row kernel of
+// sumdiag_simd.c and other layouts through mget().
+
+#include "sumdiag.h"
+
+typedef int v4si_u __attribute__((vector_size(16), aligned(1), may_alias));
+typedef int v8si_u __attribute__((vector_size(32), aligned(1), may_alias));
+
+#define BATCH_PRAGMA(x) _Pragma(#x)
+
+// Define fixed_<N>_<SUFFIX>() summing an NxN matrix with vectors of
+// type VT holding W ints; TARGET gives extra function attributes
+#define FIXED_KERNEL(N, SUFFIX, VT, W, TARGET)                          \
+  TARGET                                                                \
+  static void fixed_##N##_##SUFFIX(const int *data, int *out){          \
+    int acc[2*N-1+W] = {0};             /* room for the last window */  \
+    BATCH_PRAGMA(GCC unroll N)                                          \
+    for(int r=0; r<N; r++){                                             \
+      BATCH_PRAGMA(GCC unroll N)                                        \
+      for(int k=0; k<N; k+=W){                                          \
+        *(VT *) &acc[N-1-r+k] += *(const VT *) &data[r*N+k];            \
+      }                                                                 \
+    }                                                                   \
+    memcpy(out, acc, sizeof(int) * (2*N-1));                            \
+  }
+
+#define FIXED_SIZES(X) X(4) X(8) X(16) X(32) X(64)
+
+#define FIXED_BASE(N) FIXED_KERNEL(N, base, v4si_u, 4, )
+#define FIXED_AVX2(N) FIXED_KERNEL(N, avx2, v8si_u, 8, __attribute__((target("avx2"))))
+FIXED_SIZES(FIXED_BASE)
+FIXED_KERNEL(4, avx2, v4si_u, 4, )      // a 4 wide row is one SSE vector
+FIXED_AVX2(8) FIXED_AVX2(16) FIXED_AVX2(32) FIXED_AVX2(64)
+
+typedef void (*fixed_fn)(const int *data, int *out);
+
+// Fixed size kernel for an edge x edge matrix, NULL if there is none
+static fixed_fn fixed_kernel(long edge, int avx2){
+#define FIXED_CASE(N) case N: return avx2 ? fixed_##N##_avx2 : fixed_##N##_base;
+  switch(edge){
+    FIXED_SIZES(FIXED_CASE)
+    default: return NULL;
+  }
+#undef FIXED_CASE
+}
+
+typedef struct {
+  matrix_t *mats;
+  vector_t *vecs;
+  long count;
+  int simd;                     // 0 scalar, 1 baseline vectors, 2 AVX2
+} batch_job_t;
+
+// Diagonal sums of one matrix on the calling thread
+static void batch_one(matrix_t *mat, vector_t *vec, int simd){
+  fixed_fn fixed = mat->rows == mat->cols && mat->layout == MATRIX_ROW_MAJOR && simd > 0 ?
+    fixed_kernel(mat->rows, simd == 2) : NULL;
+  if(fixed != NULL){
+    fixed(mat->data, vec->data);
+    return;
+  }
+  memset(vec->data, 0, sizeof(int) * vec->len);
+  if(mat->layout != MATRIX_ROW_MAJOR){
+    for(long r=0; r<mat->rows; r++){
+      for(long c=0; c<mat->cols; c++){
+        vec->data[mat->rows-1-r+c] += mget(mat, r, c);
+      }
+    }
+    return;
+  }
+  row_add_fn add = sumdiag_row_kernel();
+  for(long r=0; r<mat->rows; r++){
+    add(&vec->data[mat->rows-1-r], &mat->data[r*mat->cols], mat->cols);
+  }
+}
+
+// Pool task: sum worker id's share of the matrices
+static void batch_task(void *arg, int id, int nworkers){
+  batch_job_t *job = (batch_job_t *) arg;
+  long beg, end;
+  sumdiag_pool_share(job->count, id, nworkers, &beg, &end);
+  for(long i=beg; i<end; i++){
+    batch_one(&job->mats[i], &job->vecs[i], job->simd);
+  }
+}
+
+// Sum the diagonals of each of count matrices mats[i] into vecs[i],
+// which must have length rows+cols-1, spreading the matrices over
+// thread_count threads. Returns 0 on success and 1 on error in which
+// case no sums are computed.
+int sumdiag_BATCH(matrix_t *mats, vector_t *vecs, long count, int thread_count){
+  for(long i=0; i<count; i++){
+    if(vecs[i].len != mats[i].rows + mats[i].cols - 1){
+      printf("sumdiag_batch: bad sizes for matrix %ld\n",i);
+      return 1;
+    }
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  if(thread_count > count){
+    thread_count = count > 0 ? count : 1;
+  }
+  const char *simd = sumdiag_simd_name();
+  batch_job_t job = {mats, vecs, count};
+  job.simd = strcmp(simd, "scalar") == 0 ? 0 :
+    strcmp(simd, "avx2") == 0 || strcmp(simd, "avx512") == 0 ? 2 : 1;
+  if(sumdiag_pool_run(batch_task, &job, thread_count) != 0){
+    printf("sumdiag_batch: couldn't start thread pool\n");
+    return 1;
+  }
+  return 0;
+}
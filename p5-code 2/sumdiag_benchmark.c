@@ -126,7 +126,7 @@ int main(int argc, char *argv[]){
     matrix_t mat;
     vector_t res_BASE, res_OPTM;
     matrix_init(&mat,rows,cols);
-    matrix_fill_random(mat, 100); // random values 0 to 99
+    matrix_fill_random_threads(mat, 100, thread_counts[nthread_counts-1]); // random values 0 to 99
     vector_init(&res_BASE, 2*size-1);
     vector_init(&res_OPTM, 2*size-1);
     memset(res_BASE.data, -1, sizeof(int)*res_BASE.len); // init vectors to -1
@@ -194,6 +194,7 @@ int main(int argc, char *argv[]){
 
   check_hostname();
 
+  sumdiag_pool_shutdown();      // join the worker threads
   return 0;
 }
   
@@ -0,0 +1,225 @@
+// sumdiag_binary.c: binary matrix and vector files loaded with mmap.
+//
+// Parsing text with fscanf takes far longer than summing the matrix.
+// A binary file is a 64 byte header followed, at an offset aligned as
+// the header says, by the raw ints of the data array in the layout the
+// header names. matrix_map_binary() maps the file and points the
+// matrix's data straight at the ints so loading copies nothing; pages
+// are read on first touch unless SUMDIAG_MAP_POPULATE prefaults them
+// or SUMDIAG_MAP_WILLNEED asks the kernel to read ahead. The mapping is
+// private so mset() on a mapped matrix changes memory, not the file.
+//
+// matrix_write_text() and vector_write_text() write the text format of
+// matrix_read_from_file() and vector_read_from_file() so the program
+// sumdiag_convert can translate files in either direction.
+
+#include "sumdiag.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char bin_magic[8] = "SUMDIAG";
+
+typedef struct {
+  char magic[8];                // "SUMDIAG\0"
+  uint32_t version;             // SUMDIAG_BIN_VERSION
+  uint32_t elem_type;           // SUMDIAG_BIN_INT32
+  int64_t rows;                 // vectors have a single column
+  int64_t cols;
+  uint32_t layout;              // MATRIX_ layout of the data
+  uint32_t alignment;           // data_offset is a multiple of this
+  uint64_t data_offset;         // bytes from file start to the data
+  uint32_t kind;                // SUMDIAG_BIN_MATRIX or _VECTOR
+  uint8_t pad[12];
+} bin_header_t;
+
+_Static_assert(sizeof(bin_header_t) == SUMDIAG_BIN_HEADER, "binary header must be 64 bytes");
+
+// Write the header and n ints of data, with the data at a multiple of
+// alignment, to fname. Returns 0 on success and 1 on error.
+static int bin_write(char *fname, int kind, long rows, long cols, int layout,
+                     const int *data, long n, long alignment)
+{
+  if(alignment <= 0){
+    alignment = sysconf(_SC_PAGESIZE);
+  }
+  if(alignment < SUMDIAG_BIN_HEADER || (alignment & (alignment-1)) != 0){
+    printf("%s: alignment %ld must be a power of 2 of at least %d\n",
+           fname,alignment,SUMDIAG_BIN_HEADER);
+    return 1;
+  }
+  bin_header_t head = {
+    .version = SUMDIAG_BIN_VERSION, .elem_type = SUMDIAG_BIN_INT32,
+    .rows = rows, .cols = cols, .layout = layout, .alignment = alignment,
+    .data_offset = alignment, .kind = kind,
+  };
+  memcpy(head.magic, bin_magic, sizeof(head.magic));
+
+  FILE *file = fopen(fname,"w");
+  if(file == NULL){
+    perror("couldn't open binary file");
+    return 1;
+  }
+  int ret = fwrite(&head, sizeof(head), 1, file) != 1;
+  for(long i=sizeof(head); !ret && i<alignment; i++){
+    ret = fputc(0, file) == EOF;
+  }
+  ret = ret || fwrite(data, sizeof(int), n, file) != (size_t) n;
+  ret = fclose(file) != 0 || ret;
+  if(ret){
+    printf("%s: write failed\n",fname);
+  }
+  return ret;
+}
+
+// Write mat in binary form to fname with its data aligned to alignment
+// bytes, a power of 2 of at least 64; 0 uses the page size so mapped
+// data is page aligned. Returns 0 on success and 1 on error.
+int matrix_write_binary(char *fname, matrix_t mat, long alignment){
+  return bin_write(fname, SUMDIAG_BIN_MATRIX, mat.rows, mat.cols, mat.layout, mat.data,
+                   matrix_data_len(mat.rows, mat.cols, mat.layout), alignment);
+}
+
+// Write vec in binary form to fname as for matrix_write_binary().
+int vector_write_binary(char *fname, vector_t vec, long alignment){
+  return bin_write(fname, SUMDIAG_BIN_VECTOR, vec.len, 1, MATRIX_ROW_MAJOR, vec.data,
+                   vec.len, alignment);
+}
+
+// Map fname and check that its header describes a kind of object with
+// data fitting in the file. Sets *head and *map. Returns 0 on success
+// and 1 on error.
+static int bin_map(char *fname, int kind, int flags, bin_header_t *head, matrix_map_t *map){
+  int fd = open(fname, O_RDONLY);
+  if(fd < 0){
+    perror("couldn't open binary file");
+    return 1;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(*head)){
+    printf("%s: too short for a binary header\n",fname);
+    close(fd);
+    return 1;
+  }
+  int mflags = MAP_PRIVATE | ((flags & SUMDIAG_MAP_POPULATE) ? MAP_POPULATE : 0);
+  void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, mflags, fd, 0);
+  close(fd);                    // the mapping keeps the file open
+  if(base == MAP_FAILED){
+    perror("couldn't map binary file");
+    return 1;
+  }
+  map->base = base;
+  map->len = st.st_size;
+
+  memcpy(head, base, sizeof(*head));
+  char *err = NULL;
+  if(memcmp(head->magic, bin_magic, sizeof(bin_magic)) != 0){
+    err = "not a sumdiag binary file";
+  }
+  else if(head->version != SUMDIAG_BIN_VERSION){
+    err = "unsupported version";
+  }
+  else if(head->kind != kind){
+    err = kind == SUMDIAG_BIN_MATRIX ? "not a matrix" : "not a vector";
+  }
+  else if(head->elem_type != SUMDIAG_BIN_INT32 || head->layout > MATRIX_TILED){
+    err = "unsupported element type or layout";
+  }
+  else if(head->rows <= 0 || head->cols <= 0 || head->rows > INT_MAX || head->cols > INT_MAX ||
+          (kind == SUMDIAG_BIN_VECTOR && head->cols != 1) ||
+          head->data_offset < sizeof(*head) || head->data_offset > (uint64_t) st.st_size ||
+          head->alignment == 0 || head->data_offset % head->alignment != 0 ||
+          head->data_offset % sizeof(int) != 0)
+  {
+    err = "bad sizes in header";
+  }
+  else if((uint64_t) (kind == SUMDIAG_BIN_MATRIX ?  // can't overflow with both under 2^31
+                      matrix_data_len(head->rows, head->cols, head->layout) : head->rows)
+          > (st.st_size - head->data_offset) / sizeof(int))
+  {
+    err = "file is shorter than its data";
+  }
+  if(err != NULL){
+    printf("%s: %s\n",fname,err);
+    sumdiag_unmap(map);
+    return 1;
+  }
+  if(flags & SUMDIAG_MAP_WILLNEED){
+    madvise(base, map->len, MADV_WILLNEED | MADV_SEQUENTIAL);
+  }
+  return 0;
+}
+
+// Map the binary matrix file fname setting *mat to use the mapped data
+// directly and *map to the mapping which must be released with
+// sumdiag_unmap() rather than matrix_free_data(). flags is 0 or a
+// combination of SUMDIAG_MAP_POPULATE and SUMDIAG_MAP_WILLNEED. Returns
+// 0 on success and 1 on error.
+int matrix_map_binary(char *fname, matrix_t *mat, matrix_map_t *map, int flags){
+  bin_header_t head;
+  if(bin_map(fname, SUMDIAG_BIN_MATRIX, flags, &head, map) != 0){
+    return 1;
+  }
+  mat->rows = head.rows;
+  mat->cols = head.cols;
+  mat->layout = head.layout;
+  mat->data = (int *) ((char *) map->base + head.data_offset);
+  return 0;
+}
+
+// Map the binary vector file fname as for matrix_map_binary().
+int vector_map_binary(char *fname, vector_t *vec, matrix_map_t *map, int flags){
+  bin_header_t head;
+  if(bin_map(fname, SUMDIAG_BIN_VECTOR, flags, &head, map) != 0){
+    return 1;
+  }
+  vec->len = head.rows;
+  vec->data = (int *) ((char *) map->base + head.data_offset);
+  return 0;
+}
+
+// Release a mapping made by matrix_map_binary() or vector_map_binary();
+// the matrix or vector using it must not be used afterwards.
+void sumdiag_unmap(matrix_map_t *map){
+  if(map->base != NULL){
+    munmap(map->base, map->len);
+  }
+  map->base = NULL;
+  map->len = 0;
+}
+
+// Is fname a sumdiag binary file; 0 if not or it can't be read
+int sumdiag_is_binary(char *fname){
+  char magic[sizeof(bin_magic)];
+  FILE *file = fopen(fname,"r");
+  if(file == NULL){
+    return 0;
+  }
+  int is = fread(magic, sizeof(magic), 1, file) == 1 &&
+    memcmp(magic, bin_magic, sizeof(magic)) == 0;
+  fclose(file);
+  return is;
+}
+
+// Write mat to an open file in the text format read by
+// matrix_read_from_file(): the dimensions then one row per line.
+void matrix_write_text(FILE *file, matrix_t mat){
+  fprintf(file,"%ld %ld\n",mat.rows,mat.cols);
+  for(long i=0; i<mat.rows; i++){
+    for(long j=0; j<mat.cols; j++){
+      fprintf(file, j == 0 ? "%d" : " %d", mget(&mat,i,j));
+    }
+    fprintf(file,"\n");
+  }
+}
+
+// Write vec to an open file in the text format read by
+// vector_read_from_file(): the length then one element per line.
+void vector_write_text(FILE *file, vector_t vec){
+  fprintf(file,"%ld\n",vec.len);
+  for(long i=0; i<vec.len; i++){
+    fprintf(file,"%d\n",VGET(vec,i));
+  }
+}
@@ -0,0 +1,78 @@
+#include "sumdiag.h"
+
+// Converts a matrix or vector file between the text format read by
+// matrix_read_from_file()/vector_read_from_file() and the binary format
+// of sumdiag_binary.c. The direction follows the input: binary input is
+// written as text and text input as binary with page aligned data.
+// The random form instead writes a text matrix of pb_rand() values from
+// 0 to max-1 after pb_srand(seed), generated with thread_count threads
+// by matrix_fill_random_threads(); the file is the same for any count.
+int main(int argc, char *argv[]){
+  if(argc >= 7 && strcmp(argv[1],"random")==0){
+    matrix_t mat;
+    if(matrix_init(&mat, atol(argv[2]), atol(argv[3])) != 0){
+      return 1;
+    }
+    pb_srand(atol(argv[5]));
+    int ret = matrix_fill_random_threads(mat, atoi(argv[4]), argc > 7 ? atoi(argv[7]) : 1);
+    FILE *file = ret ? NULL : fopen(argv[6],"w");
+    if(!ret && file == NULL){
+      perror("couldn't open output file");
+      ret = 1;
+    }
+    if(file != NULL){
+      matrix_write_text(file, mat);
+      ret = fclose(file) != 0;
+    }
+    matrix_free_data(&mat);
+    sumdiag_pool_shutdown();
+    return ret;
+  }
+  if(argc < 4 || (strcmp(argv[1],"matrix")!=0 && strcmp(argv[1],"vector")!=0)){
+    printf("usage: %s <matrix|vector> <infile> <outfile>\n",argv[0]);
+    printf("       %s random <rows> <cols> <max> <seed> <outfile> [thread_count]\n",argv[0]);
+    exit(1);
+  }
+  int is_matrix = strcmp(argv[1],"matrix")==0;
+  char *in = argv[2], *out = argv[3];
+
+  int ret = 1;
+  if(sumdiag_is_binary(in)){
+    matrix_map_t map;
+    matrix_t mat;
+    vector_t vec;
+    if(is_matrix ? matrix_map_binary(in, &mat, &map, SUMDIAG_MAP_WILLNEED)
+                 : vector_map_binary(in, &vec, &map, SUMDIAG_MAP_WILLNEED)){
+      return 1;
+    }
+    FILE *file = fopen(out,"w");
+    if(file == NULL){
+      perror("couldn't open output file");
+    }
+    else{
+      if(is_matrix){
+        matrix_write_text(file, mat);
+      }
+      else{
+        vector_write_text(file, vec);
+      }
+      ret = fclose(file) != 0;
+    }
+    sumdiag_unmap(&map);
+  }
+  else if(is_matrix){
+    matrix_t mat;
+    if(matrix_read_from_file(in, &mat) == 0){
+      ret = matrix_write_binary(out, mat, 0);
+      matrix_free_data(&mat);
+    }
+  }
+  else{
+    vector_t vec;
+    if(vector_read_from_file(in, &vec) == 0){
+      ret = vector_write_binary(out, vec, 0);
+      vector_free_data(&vec);
+    }
+  }
+  return ret;
+}
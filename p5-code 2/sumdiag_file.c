@@ -0,0 +1,415 @@
+#include "sumdiag.h"
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Computes the diagonal sums of a matrix stored in a file and prints
+// them. The mode selects how the file is read and summed; see modes[]
+// below. Modes reading the dense text format convert the matrix to the
+// layout named by SUMDIAG_LAYOUT (rowmajor, colmajor, diagmajor or
+// morton) first if it is set.
+
+// Print the dimensions and diagonal sums as every mode does
+static void print_sums(long rows, long cols, vector_t vec){
+  printf("%ld x %ld matrix\n",rows,cols);
+  printf("Diagonal Sums:\n");
+  vector_write(stdout, vec);
+}
+
+// Read the dense text matrix fname into *mat in the SUMDIAG_LAYOUT
+// layout and make vec the right length for its sums. Returns 0 on
+// success and 1 on error.
+static int load_dense(char *fname, matrix_t *mat, vector_t *vec, int thread_count){
+  static const char *layouts[] = {"rowmajor", "colmajor", "diagmajor", "morton"};
+  char *env = getenv("SUMDIAG_LAYOUT");
+  int layout = -1;
+  for(int i=0; env != NULL && i<4; i++){
+    if(strcmp(env, layouts[i])==0){
+      layout = i;
+    }
+  }
+  if(env != NULL && layout < 0){
+    printf("unknown layout '%s'\n",env);
+    return 1;
+  }
+  if(matrix_read_from_file(fname, mat) != 0){
+    return 1;
+  }
+  if(layout > MATRIX_ROW_MAJOR){
+    matrix_t lmat;
+    int ret = matrix_convert(*mat, &lmat, layout, thread_count);
+    matrix_free_data(mat);
+    if(ret != 0){
+      return 1;
+    }
+    *mat = lmat;
+  }
+  if(vector_init(vec, mat->rows + mat->cols - 1) != 0){
+    matrix_free_data(mat);
+    return 1;
+  }
+  return 0;
+}
+
+// dense: sumdiag_OPTM()
+static int mode_dense(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vec;
+  if(load_dense(fname, &mat, &vec, thread_count) != 0){
+    return 1;
+  }
+  int ret = sumdiag_OPTM(mat, vec, thread_count);
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vec);
+  }
+  matrix_free_data(&mat);
+  vector_free_data(&vec);
+  return ret;
+}
+
+// sparse: coordinate format of sparse_read_from_file(); sumdiag_SPARSE()
+// nonzeros: dense format converted by sparse_from_dense(); sumdiag_SPARSE()
+static int mode_sparse(char *mode, char *fname, int thread_count){
+  sparse_matrix_t smat;
+  if(strcmp(mode,"sparse")==0){
+    if(sparse_read_from_file(fname, &smat) != 0){
+      return 1;
+    }
+  }
+  else{
+    matrix_t mat;
+    vector_t unused;
+    if(load_dense(fname, &mat, &unused, thread_count) != 0){
+      return 1;
+    }
+    int ret = sparse_from_dense(&smat, mat);
+    matrix_free_data(&mat);
+    vector_free_data(&unused);
+    if(ret != 0){
+      return 1;
+    }
+  }
+  printf("Sparse matrix: %ld nonzeros\n",smat.nnz);
+  vector_t vec;
+  vector_init(&vec, smat.rows + smat.cols - 1);
+  int ret = sumdiag_SPARSE(smat, vec, thread_count);
+  if(ret == 0){
+    print_sums(smat.rows, smat.cols, vec);
+  }
+  sparse_free_data(&smat);
+  vector_free_data(&vec);
+  return ret;
+}
+
+// stream: dense format read in chunks by sumdiag_STREAM() so the whole
+// matrix is never in memory; a file of - reads stdin and the buffers
+// use SUMDIAG_BUDGET bytes, default 64MB
+static int mode_stream(char *mode, char *fname, int thread_count){
+  FILE *file = strcmp(fname,"-")==0 ? stdin : fopen(fname,"r");
+  if(file == NULL){
+    perror("couldn't open matrix file");
+    return 1;
+  }
+  char *env = getenv("SUMDIAG_BUDGET");
+  long budget = env != NULL && atol(env) > 0 ? atol(env) : 64L << 20;
+  vector_t vec;
+  long rows, cols;
+  int ret = sumdiag_STREAM(file, budget, &vec, &rows, &cols);
+  if(file != stdin){
+    fclose(file);
+  }
+  if(ret == 0){
+    print_sums(rows, cols, vec);
+    vector_free_data(&vec);
+  }
+  return ret;
+}
+
+// binary: file written by matrix_write_binary() mapped without copying
+// by matrix_map_binary(); sumdiag_OPTM()
+static int mode_binary(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  matrix_map_t map;
+  if(matrix_map_binary(fname, &mat, &map, SUMDIAG_MAP_WILLNEED) != 0){
+    return 1;
+  }
+  vector_t vec;
+  vector_init(&vec, mat.rows + mat.cols - 1);
+  int ret = sumdiag_OPTM(mat, vec, thread_count);
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vec);
+  }
+  vector_free_data(&vec);
+  sumdiag_unmap(&map);
+  return ret;
+}
+
+// procs: binary file summed by thread_count forked worker processes
+// with sumdiag_PROCS(); a dense text file is first copied to shared
+// memory by matrix_to_shm()
+static int mode_procs(char *mode, char *fname, int thread_count){
+  char name[64], path[128];
+  name[0] = '\0';
+  if(!sumdiag_is_binary(fname)){
+    matrix_t mat;
+    if(matrix_read_from_file(fname, &mat) != 0){
+      return 1;
+    }
+    snprintf(name, sizeof(name), "/sumdiag_file_%d", (int) getpid());
+    int ret = matrix_to_shm(name, mat, path, sizeof(path));
+    matrix_free_data(&mat);
+    if(ret != 0){
+      return 1;
+    }
+    fname = path;
+  }
+  vector_t vec;
+  long rows, cols;
+  int ret = sumdiag_PROCS(fname, thread_count, &vec, &rows, &cols);
+  if(name[0] != '\0'){
+    shm_unlink(name);
+  }
+  if(ret == 0){
+    print_sums(rows, cols, vec);
+    vector_free_data(&vec);
+  }
+  return ret;
+}
+
+// fused: sumdiag_FUSED() with the anti-diagonal, row and column sums
+static int mode_fused(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  fused_out_t out;
+  if(load_dense(fname, &mat, &out.diag, thread_count) != 0){
+    return 1;
+  }
+  vector_init(&out.anti, mat.rows + mat.cols - 1);
+  vector_init(&out.row, mat.rows);
+  vector_init(&out.col, mat.cols);
+  int ret = sumdiag_FUSED(mat, FUSED_ALL, out, thread_count);
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, out.diag);
+    printf("Anti-diagonal Sums:\n");
+    vector_write(stdout, out.anti);
+    printf("Row Sums:\n");
+    vector_write(stdout, out.row);
+    printf("Column Sums:\n");
+    vector_write(stdout, out.col);
+  }
+  matrix_free_data(&mat);
+  vector_free_data(&out.diag);
+  vector_free_data(&out.anti);
+  vector_free_data(&out.row);
+  vector_free_data(&out.col);
+  return ret;
+}
+
+// reduce: sums through diag_reduce() followed by the other operators;
+// counts and means are of elements above half the largest
+static int mode_reduce(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vec;
+  if(load_dense(fname, &mat, &vec, thread_count) != 0){
+    return 1;
+  }
+  vector_t mins, maxs, cnts, avgs;
+  vector_init(&mins, vec.len);
+  vector_init(&maxs, vec.len);
+  vector_init(&cnts, vec.len);
+  vector_init(&avgs, vec.len);
+  double *means = malloc(sizeof(double) * vec.len);
+  int ret = diag_reduce(mat, (diag_op_t){DIAG_SUM}, vec, NULL, thread_count)
+    || diag_reduce(mat, (diag_op_t){DIAG_MIN}, mins, NULL, thread_count)
+    || diag_reduce(mat, (diag_op_t){DIAG_MAX}, maxs, NULL, thread_count);
+  int thresh = 0;
+  for(long i=0; !ret && i<maxs.len; i++){
+    thresh = VGET(maxs,i) / 2 > thresh ? VGET(maxs,i) / 2 : thresh;
+  }
+  ret = ret
+    || diag_reduce(mat, (diag_op_t){DIAG_COUNT, DIAG_ABOVE, thresh}, cnts, NULL, thread_count)
+    || diag_reduce(mat, (diag_op_t){DIAG_MEAN, DIAG_ABOVE, thresh}, avgs, means, thread_count);
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vec);
+    printf("Diagonal Reductions (COUNT and MEAN of elements > %d):\n", thresh);
+    printf("[ i]:  MIN  MAX COUNT   MEAN\n");
+    for(long i=0; i<mins.len; i++){
+      printf("[%2ld]: %4d %4d %5d %6.1f\n",i,VGET(mins,i),VGET(maxs,i),VGET(cnts,i),means[i]);
+    }
+  }
+  free(means);
+  matrix_free_data(&mat);
+  vector_free_data(&vec);
+  vector_free_data(&mins);
+  vector_free_data(&maxs);
+  vector_free_data(&cnts);
+  vector_free_data(&avgs);
+  return ret;
+}
+
+// i8 i16 i32 i64 f32 f64: sumdiag_<type>() on a copy of the matrix
+// converted to that element type, sums printed as ints
+static int mode_typed(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vec;
+  if(load_dense(fname, &mat, &vec, thread_count) != 0){
+    return 1;
+  }
+  int ret = 1;
+#define TRY_TYPE(NAME, T, RESULT)                               \
+  if(strcmp(mode, #NAME)==0){                                   \
+    matrix_##NAME##_t tmat;                                     \
+    vector_##RESULT##_t tvec;                                   \
+    matrix_##NAME##_init(&tmat, mat.rows, mat.cols);            \
+    vector_##RESULT##_init(&tvec, vec.len);                     \
+    matrix_##NAME##_from_int(tmat, mat);                        \
+    ret = sumdiag_##NAME(tmat, tvec, thread_count);             \
+    for(long i=0; i<vec.len; i++){                              \
+      VSET(vec, i, (int) tvec.data[i]);                         \
+    }                                                           \
+    matrix_##NAME##_free_data(&tmat);                           \
+    vector_##RESULT##_free_data(&tvec);                         \
+  }
+  SUMDIAG_TYPES(TRY_TYPE)
+#undef TRY_TYPE
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vec);
+  }
+  matrix_free_data(&mat);
+  vector_free_data(&vec);
+  return ret;
+}
+
+// narrow: sumdiag_NARROW() on a copy packed by narrow_matrix_from()
+static int mode_narrow(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vec;
+  if(load_dense(fname, &mat, &vec, thread_count) != 0){
+    return 1;
+  }
+  narrow_matrix_t nmat;
+  int ret = narrow_matrix_from(&nmat, mat);
+  if(ret == 0){
+    printf("Narrow width: %d\n", nmat.width);
+    ret = sumdiag_NARROW(nmat, vec, thread_count);
+    narrow_matrix_free_data(&nmat);
+  }
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vec);
+  }
+  matrix_free_data(&mat);
+  vector_free_data(&vec);
+  return ret;
+}
+
+// tracked: sums kept by a tracked_matrix_t starting from zeros with
+// the matrix added as one tracked_add_batch() and single tracked_set()
+// changes made and undone
+static int mode_tracked(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vec;
+  if(load_dense(fname, &mat, &vec, thread_count) != 0){
+    return 1;
+  }
+  long rows = mat.rows, cols = mat.cols;
+  matrix_t zero;
+  matrix_init(&zero, rows, cols);
+  memset(zero.data, 0, sizeof(int) * rows * cols);
+  tracked_matrix_t tm;
+  cell_update_t *updates = malloc(sizeof(cell_update_t) * rows * cols);
+  int ret = updates == NULL || tracked_init(&tm, zero, thread_count) != 0;
+  if(ret == 0){
+    for(long i=0; i<rows*cols; i++){
+      updates[i] = (cell_update_t){i / cols, i % cols, mget(&mat, i / cols, i % cols)};
+    }
+    ret = tracked_add_batch(&tm, updates, rows*cols);
+    tracked_set(&tm, 0, 0, -5);
+    tracked_set(&tm, rows-1, 0, 1000);
+    tracked_set(&tm, 0, 0, mget(&mat, 0, 0));
+    tracked_set(&tm, rows-1, 0, mget(&mat, rows-1, 0));
+    memcpy(vec.data, tm.sums.data, sizeof(int) * vec.len);
+    tracked_free_data(&tm);
+  }
+  if(ret == 0){
+    print_sums(rows, cols, vec);
+  }
+  free(updates);
+  matrix_free_data(&zero);
+  matrix_free_data(&mat);
+  vector_free_data(&vec);
+  return ret;
+}
+
+// batch: sumdiag_BATCH() on three copies of the matrix which must all
+// give the same sums
+static int mode_batch(char *mode, char *fname, int thread_count){
+  matrix_t mat;
+  vector_t vecs[3];
+  if(load_dense(fname, &mat, &vecs[0], thread_count) != 0){
+    return 1;
+  }
+  matrix_t mats[3] = {mat, mat, mat};
+  vector_init(&vecs[1], vecs[0].len);
+  vector_init(&vecs[2], vecs[0].len);
+  int ret = sumdiag_BATCH(mats, vecs, 3, thread_count);
+  for(int i=1; i<3; i++){
+    if(ret == 0 && memcmp(vecs[i].data, vecs[0].data, sizeof(int) * vecs[0].len) != 0){
+      printf("batch result %d differs\n", i);
+      ret = 1;
+    }
+  }
+  if(ret == 0){
+    print_sums(mat.rows, mat.cols, vecs[0]);
+  }
+  matrix_free_data(&mat);
+  for(int i=0; i<3; i++){
+    vector_free_data(&vecs[i]);
+  }
+  return ret;
+}
+
+typedef struct {
+  char *name;
+  int (*run)(char *mode, char *fname, int thread_count);
+} file_mode_t;
+
+static file_mode_t modes[] = {
+  {"dense",    mode_dense},   {"sparse",   mode_sparse},
+  {"nonzeros", mode_sparse},  {"stream",   mode_stream},
+  {"binary",   mode_binary},  {"procs",    mode_procs},
+  {"fused",    mode_fused},   {"reduce",   mode_reduce},
+  {"i8",       mode_typed},   {"i16",      mode_typed},
+  {"i32",      mode_typed},   {"i64",      mode_typed},
+  {"f32",      mode_typed},   {"f64",      mode_typed},
+  {"narrow",   mode_narrow},  {"tracked",  mode_tracked},
+  {"batch",    mode_batch},
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+int main(int argc, char *argv[]){
+  if(argc < 3){
+    printf("usage: %s <matrix_file> <thread_count> [mode]\n",argv[0]);
+    printf("modes:");
+    for(int i=0; i<NMODES; i++){
+      printf(" %s",modes[i].name);
+    }
+    printf("\n");
+    exit(1);
+  }
+  char *fname = argv[1];
+  int thread_count = atoi(argv[2]);
+  char *mode = argc > 3 ? argv[3] : "dense";
+
+  file_mode_t *found = NULL;
+  for(int i=0; i<NMODES; i++){
+    if(strcmp(mode, modes[i].name)==0){
+      found = &modes[i];
+    }
+  }
+  if(found == NULL){
+    printf("unknown mode '%s'\n",mode);
+    exit(1);
+  }
+  int ret = found->run(mode, fname, thread_count);
+  sumdiag_pool_shutdown();      // join the worker threads
+  return ret != 0;
+}
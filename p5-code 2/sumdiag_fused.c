@@ -0,0 +1,154 @@
+// sumdiag_fused.c: several reductions of a matrix in one pass.
+//
+// Diagonal sums, anti-diagonal sums, row sums and column sums each
+// need only one read of every element, but computing them separately
+// reads a large matrix from memory once per reduction. Here each row
+// is read once in chunks small enough to stay in L1 and every
+// requested reduction is applied to the chunk before moving on:
+//
+//   diagonal      (r,c) -> diag[rows-1-r+c]   row adds into a window
+//   anti-diagonal (r,c) -> anti[r+c]          row adds into a window
+//   row           (r,c) -> row[r]             horizontal sum of the row
+//   column        (r,c) -> col[c]             row adds into col
+//
+// so all but row sums use the same SIMD add kernel as sumdiag_ROWS().
+// With several threads each takes a band of rows; row sums are written
+// directly while the others go to per-thread partial vectors which are
+// tree reduced as in sumdiag_OPTM().
+
+#include "sumdiag.h"
+#include "probes.h"
+
+#define FUSED_CHUNK 2048        // ints of a row handled at a time
+
+typedef struct {
+  matrix_t mat;
+  int which;                    // FUSED_* bits
+  fused_out_t out;
+  int *partials;                // diag, anti and col partials of workers 1 and up
+  long diag_stride;             // padded lengths of the partial parts
+  long col_stride;
+  long worker_stride;           // ints from one worker's partials to the next
+} fused_job_t;
+
+// Output vectors of worker id: its partials or, for worker 0, the
+// final outputs. Row sums always go to the final output.
+static fused_out_t fused_worker_out(fused_job_t *job, int id){
+  fused_out_t out = job->out;
+  if(id == 0){
+    return out;
+  }
+  int *base = job->partials + (id-1) * job->worker_stride;
+  out.diag.data = base;
+  out.anti.data = base + job->diag_stride;
+  out.col.data  = base + 2*job->diag_stride;
+  return out;
+}
+
+// Tree reduction step: add the partials of worker src into dst's
+static void fused_merge(void *arg, int dst, int src, int end, int nworkers){
+  fused_job_t *job = (fused_job_t *) arg;
+  row_add_fn add = sumdiag_row_kernel();
+  fused_out_t to = fused_worker_out(job, dst);
+  fused_out_t from = fused_worker_out(job, src);
+  if(job->which & FUSED_DIAG){
+    add(to.diag.data, from.diag.data, to.diag.len);
+  }
+  if(job->which & FUSED_ANTI){
+    add(to.anti.data, from.anti.data, to.anti.len);
+  }
+  if(job->which & FUSED_COL){
+    add(to.col.data, from.col.data, to.col.len);
+  }
+}
+
+// Pool task: reduce worker id's band of rows then combine partials
+static void fused_task(void *arg, int id, int nworkers){
+  fused_job_t *job = (fused_job_t *) arg;
+  matrix_t mat = job->mat;
+  int which = job->which;
+  row_add_fn add = sumdiag_row_kernel();
+  row_sum_fn sum = sumdiag_row_sum_kernel();
+  fused_out_t out = fused_worker_out(job, id);
+
+  long r0, r1;
+  sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+  PROBE5(sumdiag, worker_start, id, r0, r1, mat.rows, mat.cols);
+  if(which & FUSED_DIAG){
+    memset(out.diag.data, 0, sizeof(int) * out.diag.len);
+  }
+  if(which & FUSED_ANTI){
+    memset(out.anti.data, 0, sizeof(int) * out.anti.len);
+  }
+  if(which & FUSED_COL){
+    memset(out.col.data, 0, sizeof(int) * out.col.len);
+  }
+
+  for(long r=r0; r<r1; r++){
+    int rsum = 0;
+    for(long c=0; c<mat.cols; c+=FUSED_CHUNK){
+      long n = c + FUSED_CHUNK < mat.cols ? FUSED_CHUNK : mat.cols - c;
+      const int *src = &mat.data[r*mat.cols + c];
+      if(which & FUSED_DIAG){
+        add(&out.diag.data[mat.rows-1-r+c], src, n);
+      }
+      if(which & FUSED_ANTI){
+        add(&out.anti.data[r+c], src, n);
+      }
+      if(which & FUSED_COL){
+        add(&out.col.data[c], src, n);
+      }
+      if(which & FUSED_ROW){
+        rsum += sum(src, n);
+      }
+    }
+    if(which & FUSED_ROW){
+      VSET(out.row, r, rsum);
+    }
+  }
+
+  sumdiag_pool_tree(id, nworkers, fused_merge, job);
+  PROBE5(sumdiag, worker_end, id, r0, r1, mat.rows, mat.cols);
+}
+
+// Compute the reductions selected by the FUSED_* bits in which with a
+// single pass over the matrix using thread_count threads. The
+// corresponding vectors of out must be initialized to the right
+// lengths: rows+cols-1 for diag and anti, rows for row and cols for
+// col; unselected vectors are ignored. Returns 0 on success and 1 on
+// bad sizes or if the threads can't be run.
+int sumdiag_FUSED(matrix_t mat, int which, fused_out_t out, int thread_count){
+  long diags = mat.rows + mat.cols - 1;
+  if(((which & FUSED_DIAG) && out.diag.len != diags) ||
+     ((which & FUSED_ANTI) && out.anti.len != diags) ||
+     ((which & FUSED_ROW)  && out.row.len  != mat.rows) ||
+     ((which & FUSED_COL)  && out.col.len  != mat.cols))
+  {
+    printf("sumdiag_fused: bad sizes\n");
+    return 1;
+  }
+  if(mat.layout != MATRIX_ROW_MAJOR){
+    printf("sumdiag_fused: bad layout\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+
+  fused_job_t job = {mat, which, out};
+  job.diag_stride = sumdiag_pool_stride(diags);
+  job.col_stride = sumdiag_pool_stride(mat.cols);
+  job.worker_stride = 2*job.diag_stride + job.col_stride;
+  if(thread_count > 1){
+    job.partials = sumdiag_pool_scratch(sizeof(int) * job.worker_stride * (thread_count-1));
+    if(job.partials == NULL){
+      printf("sumdiag_fused: out of memory\n");
+      return 1;
+    }
+  }
+  if(sumdiag_pool_run(fused_task, &job, thread_count) != 0){
+    printf("sumdiag_fused: couldn't start thread pool\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,250 @@
+// sumdiag_layout.c: storage layouts other than row-major for matrix_t.
+//
+// The layout field of a matrix_t says how element (r,c) is placed in
+// its data array:
+//
+//   MATRIX_ROW_MAJOR   data[r*cols + c], as MGET()/MSET() assume
+//   MATRIX_COL_MAJOR   data[c*rows + r]
+//   MATRIX_DIAG_MAJOR  each diagonal stored contiguously from its top
+//                      left end, diagonals in the order of sumdiag's
+//                      output so diagonal d is one run of memory
+//   MATRIX_TILED       16x16 tiles, tiles in row-major order and the
+//                      elements of each tile in Z (Morton) order; edge
+//                      tiles are padded with zeros
+//
+// matrix_offset() maps (r,c) to a data index for any layout and is
+// used by mget()/mset(). matrix_convert() copies a matrix into another
+// layout in parallel and sumdiag_LAYOUT() sums diagonals with a kernel
+// suited to each layout; on diagonal-major data that is a sequential
+// sum of each run.
+
+#include "sumdiag.h"
+#include "probes.h"
+
+#define TILE MATRIX_TILE_EDGE
+
+// Tile grid size; the tiled layout pads rows and cols up to multiples
+// of TILE
+static long tiles_across(long n){
+  return (n + TILE - 1) / TILE;
+}
+
+// Interleave the bits of r and c, c in the low bit, giving the Z order
+// position of (r,c) within a tile
+static int morton(int r, int c){
+  int z = 0;
+  for(int b=0; b<4; b++){
+    z |= ((c >> b) & 1) << (2*b);
+    z |= ((r >> b) & 1) << (2*b + 1);
+  }
+  return z;
+}
+
+// Number of elements on diagonal d of a rows by cols matrix
+static long diag_length(long rows, long cols, long d){
+  long m = rows < cols ? rows : cols;
+  long ndiags = rows + cols - 1;
+  long len = d + 1 < ndiags - d ? d + 1 : ndiags - d;
+  return len < m ? len : m;
+}
+
+// Index of the first element of diagonal d in diagonal-major storage.
+// Lengths ramp up 1,2,..,m-1, stay at m for a plateau then ramp down
+// ..,2,1 so each part has a closed form.
+static long diag_start(long rows, long cols, long d){
+  long m = rows < cols ? rows : cols;
+  long ndiags = rows + cols - 1;
+  long plateau = ndiags - 2*(m-1);
+  if(d < m-1){
+    return d*(d+1)/2;
+  }
+  if(d < m-1 + plateau){
+    return (m-1)*m/2 + (d-(m-1))*m;
+  }
+  long rest = ndiags - d;               // diagonals from d to the end
+  return rows*cols - rest*(rest+1)/2;
+}
+
+// Number of ints of data needed for a rows by cols matrix in layout
+long matrix_data_len(long rows, long cols, int layout){
+  if(layout == MATRIX_TILED){
+    return tiles_across(rows) * tiles_across(cols) * TILE * TILE;
+  }
+  return rows * cols;
+}
+
+// Index in mat->data of element (r,c) according to the layout
+long matrix_offset(matrix_t *mat, long r, long c){
+  switch(mat->layout){
+    case MATRIX_COL_MAJOR:
+      return c*mat->rows + r;
+    case MATRIX_DIAG_MAJOR: {
+      long d = mat->rows-1-r+c;
+      long top = mat->rows-1-d > 0 ? mat->rows-1-d : 0;   // row where diagonal d starts
+      return diag_start(mat->rows, mat->cols, d) + (r - top);
+    }
+    case MATRIX_TILED: {
+      long tile = (r/TILE) * tiles_across(mat->cols) + c/TILE;
+      return tile*TILE*TILE + morton(r%TILE, c%TILE);
+    }
+    default:
+      return r*mat->cols + c;
+  }
+}
+
+typedef struct {
+  matrix_t src;
+  matrix_t dst;
+} convert_job_t;
+
+// Pool task: copy worker id's band of rows; reads are sequential when
+// the source is row-major
+static void convert_task(void *arg, int id, int nworkers){
+  convert_job_t *job = (convert_job_t *) arg;
+  long r0, r1;
+  sumdiag_pool_share(job->src.rows, id, nworkers, &r0, &r1);
+  for(long r=r0; r<r1; r++){
+    for(long c=0; c<job->src.cols; c++){
+      job->dst.data[matrix_offset(&job->dst, r, c)] =
+        job->src.data[matrix_offset(&job->src, r, c)];
+    }
+  }
+}
+
+// Initialize dst as a copy of src stored in layout using thread_count
+// threads. dst must later be freed with matrix_free_data(). Returns 0
+// on success and 1 on a bad layout or if out of memory.
+int matrix_convert(matrix_t src, matrix_t *dst, int layout, int thread_count){
+  if(layout < MATRIX_ROW_MAJOR || layout > MATRIX_TILED){
+    printf("matrix_convert: bad layout %d\n",layout);
+    return 1;
+  }
+  matrix_t mat = {src.rows, src.cols, NULL, layout};
+  mat.data = calloc(matrix_data_len(src.rows, src.cols, layout), sizeof(int));
+  if(mat.data == NULL){
+    printf("matrix_convert: out of memory\n");
+    return 1;
+  }
+  convert_job_t job = {src, mat};
+  if(sumdiag_pool_run(convert_task, &job, thread_count < 1 ? 1 : thread_count) != 0){
+    free(mat.data);
+    printf("matrix_convert: couldn't start thread pool\n");
+    return 1;
+  }
+  *dst = mat;
+  return 0;
+}
+
+typedef struct {
+  matrix_t mat;
+  vector_t vec;
+  int *partials;                // tiled: partial vectors of workers 1 and up
+  long stride;
+} layout_job_t;
+
+// Pool task for diagonal-major data: worker id sums the diagonals
+// holding its share of the elements, each a contiguous run, and
+// writes them straight to vec
+static void diag_major_task(void *arg, int id, int nworkers){
+  layout_job_t *job = (layout_job_t *) arg;
+  matrix_t mat = job->mat;
+  row_sum_fn sum = sumdiag_row_sum_kernel();
+  long e0, e1;
+  sumdiag_pool_share(mat.rows * mat.cols, id, nworkers, &e0, &e1);
+  for(long d=0; d<job->vec.len; d++){   // each diagonal goes to the worker holding its start
+    long start = diag_start(mat.rows, mat.cols, d);
+    if(start >= e0 && start < e1){
+      VSET(job->vec, d, sum(&mat.data[start], diag_length(mat.rows, mat.cols, d)));
+    }
+  }
+}
+
+// Pool task for tiled data: worker id takes its share of the tiles,
+// accumulating each into the 2*TILE-1 local diagonals of the tile
+// using a table of each Z order position's local diagonal, then adds
+// them into its partial. Padding is zero so only the part of the local
+// diagonals inside the matrix is added.
+static void tiled_task(void *arg, int id, int nworkers){
+  layout_job_t *job = (layout_job_t *) arg;
+  matrix_t mat = job->mat;
+  row_add_fn add = sumdiag_row_kernel();
+  int *part = id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+  long len = job->vec.len;
+  memset(part, 0, sizeof(int) * len);
+
+  unsigned char local_diag[TILE*TILE];  // local diagonal of each Z position
+  for(int i=0; i<TILE; i++){
+    for(int j=0; j<TILE; j++){
+      local_diag[morton(i,j)] = TILE-1-i+j;
+    }
+  }
+
+  long ctiles = tiles_across(mat.cols);
+  long t0, t1;
+  sumdiag_pool_share(tiles_across(mat.rows) * ctiles, id, nworkers, &t0, &t1);
+  for(long t=t0; t<t1; t++){
+    int local[2*TILE-1] = {0};
+    const int *tile = &mat.data[t*TILE*TILE];
+    for(int k=0; k<TILE*TILE; k++){
+      local[local_diag[k]] += tile[k];
+    }
+    long base = mat.rows - (t/ctiles)*TILE - TILE + (t%ctiles)*TILE;   // global diagonal of local 0
+    long k0 = base < 0 ? -base : 0;
+    long k1 = base + 2*TILE-1 > len ? len - base : 2*TILE-1;
+    if(k1 > k0){
+      add(&part[base+k0], &local[k0], k1-k0);
+    }
+  }
+
+  sumdiag_pool_reduce(part, job->partials, job->stride, len, id, nworkers, add);
+}
+
+// Diagonal sums of mat in any layout into vec using thread_count
+// threads. Row-major data goes to sumdiag_OPTM(); column-major data is
+// the row-major transpose whose diagonal sums are those of mat in
+// reverse order. Returns 0 on success and 1 on error.
+int sumdiag_LAYOUT(matrix_t mat, vector_t vec, int thread_count){
+  if(vec.len != (mat.rows + mat.cols - 1)){
+    printf("sumdiag_layout: bad sizes\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  layout_job_t job = {mat, vec};
+  switch(mat.layout){
+    case MATRIX_ROW_MAJOR:
+      return sumdiag_OPTM(mat, vec, thread_count);
+
+    case MATRIX_COL_MAJOR: {
+      matrix_t trans = {mat.cols, mat.rows, mat.data, MATRIX_ROW_MAJOR};
+      if(sumdiag_OPTM(trans, vec, thread_count) != 0){
+        return 1;
+      }
+      for(long i=0, j=vec.len-1; i<j; i++, j--){
+        int tmp = vec.data[i];
+        vec.data[i] = vec.data[j];
+        vec.data[j] = tmp;
+      }
+      return 0;
+    }
+
+    case MATRIX_DIAG_MAJOR:
+      return sumdiag_pool_run(diag_major_task, &job, thread_count);
+
+    case MATRIX_TILED:
+      job.stride = sumdiag_pool_stride(vec.len);
+      if(thread_count > 1){
+        job.partials = sumdiag_pool_scratch(sizeof(int) * job.stride * (thread_count-1));
+        if(job.partials == NULL){
+          printf("sumdiag_layout: out of memory\n");
+          return 1;
+        }
+      }
+      return sumdiag_pool_run(tiled_task, &job, thread_count);
+
+    default:
+      printf("sumdiag_layout: bad layout %d\n",mat.layout);
+      return 1;
+  }
+}
@@ -0,0 +1,256 @@
+// sumdiag_narrow.c: diagonal sums over matrices stored with 8 or 16
+// bit elements.
+//
+// sumdiag is limited by memory bandwidth and most data, including that
+// of matrix_fill_random(mat,100), fits in far fewer than 32 bits.
+// narrow_matrix_from() copies a matrix into the narrowest of 1, 2 or 4
+// byte elements which holds its range and sumdiag_NARROW() sums the
+// packed rows directly, sign extending them to int in SIMD registers
+// as they are added into the result window. Reading 8-bit elements
+// moves a quarter of the bytes of the int matrix. Sums are int as for
+// sumdiag_BASE(); the 4 byte case just uses the plain row kernel.
+
+#include "sumdiag.h"
+#include "probes.h"
+#include <immintrin.h>
+
+// Adds n packed elements of src into the ints at dst
+typedef void (*narrow_add_fn)(int *dst, const void *src, long n);
+
+static void add_i8_scalar(int *dst, const void *vsrc, long n){
+  const int8_t *src = vsrc;
+  for(long i=0; i<n; i++){
+    dst[i] += src[i];
+  }
+}
+
+static void add_i16_scalar(int *dst, const void *vsrc, long n){
+  const int16_t *src = vsrc;
+  for(long i=0; i<n; i++){
+    dst[i] += src[i];
+  }
+}
+
+// SSE2 has no sign extending loads: interleave each byte with itself
+// and shift the copies down arithmetically
+__attribute__((target("sse2")))
+static void add_i8_sse2(int *dst, const void *vsrc, long n){
+  const int8_t *src = vsrc;
+  long i = 0;
+  for(; i+16 <= n; i+=16){
+    __m128i x  = _mm_loadu_si128((const __m128i *) (src+i));
+    __m128i lo = _mm_unpacklo_epi8(x, x);
+    __m128i hi = _mm_unpackhi_epi8(x, x);
+    __m128i w[4] = {
+      _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 24),
+      _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 24),
+      _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 24),
+      _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 24),
+    };
+    for(int k=0; k<4; k++){
+      __m128i d = _mm_loadu_si128((const __m128i *) (dst+i+4*k));
+      _mm_storeu_si128((__m128i *) (dst+i+4*k), _mm_add_epi32(d, w[k]));
+    }
+  }
+  add_i8_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void add_i16_sse2(int *dst, const void *vsrc, long n){
+  const int16_t *src = vsrc;
+  long i = 0;
+  for(; i+8 <= n; i+=8){
+    __m128i x  = _mm_loadu_si128((const __m128i *) (src+i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    __m128i d0 = _mm_loadu_si128((const __m128i *) (dst+i));
+    __m128i d1 = _mm_loadu_si128((const __m128i *) (dst+i+4));
+    _mm_storeu_si128((__m128i *) (dst+i),   _mm_add_epi32(d0, lo));
+    _mm_storeu_si128((__m128i *) (dst+i+4), _mm_add_epi32(d1, hi));
+  }
+  add_i16_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void add_i8_avx2(int *dst, const void *vsrc, long n){
+  const int8_t *src = vsrc;
+  long i = 0;
+  for(; i+8 <= n; i+=8){
+    __m256i x = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (src+i)));
+    __m256i d = _mm256_loadu_si256((const __m256i *) (dst+i));
+    _mm256_storeu_si256((__m256i *) (dst+i), _mm256_add_epi32(d, x));
+  }
+  add_i8_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void add_i16_avx2(int *dst, const void *vsrc, long n){
+  const int16_t *src = vsrc;
+  long i = 0;
+  for(; i+8 <= n; i+=8){
+    __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (src+i)));
+    __m256i d = _mm256_loadu_si256((const __m256i *) (dst+i));
+    _mm256_storeu_si256((__m256i *) (dst+i), _mm256_add_epi32(d, x));
+  }
+  add_i16_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void add_i8_avx512(int *dst, const void *vsrc, long n){
+  const int8_t *src = vsrc;
+  long i = 0;
+  for(; i+16 <= n; i+=16){
+    __m512i x = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *) (src+i)));
+    __m512i d = _mm512_loadu_si512(dst+i);
+    _mm512_storeu_si512(dst+i, _mm512_add_epi32(d, x));
+  }
+  add_i8_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void add_i16_avx512(int *dst, const void *vsrc, long n){
+  const int16_t *src = vsrc;
+  long i = 0;
+  for(; i+16 <= n; i+=16){
+    __m512i x = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *) (src+i)));
+    __m512i d = _mm512_loadu_si512(dst+i);
+    _mm512_storeu_si512(dst+i, _mm512_add_epi32(d, x));
+  }
+  add_i16_scalar(dst+i, src+i, n-i);
+}
+
+// 4 byte elements are plain ints
+static void add_i32(int *dst, const void *src, long n){
+  sumdiag_row_kernel()(dst, src, n);
+}
+
+// Kernels by instruction set in the order of sumdiag_simd.c
+static struct {
+  const char *name;
+  narrow_add_fn i8, i16;
+} narrow_kernels[] = {
+  {"scalar", add_i8_scalar, add_i16_scalar},
+  {"sse2",   add_i8_sse2,   add_i16_sse2},
+  {"avx2",   add_i8_avx2,   add_i16_avx2},
+  {"avx512", add_i8_avx512, add_i16_avx512},
+};
+
+// Widening kernel for elements of width bytes using the instruction
+// set selected in sumdiag_simd.c
+static narrow_add_fn narrow_kernel(int width){
+  if(width == 4){
+    return add_i32;
+  }
+  const char *simd = sumdiag_simd_name();
+  for(int i=1; i<4; i++){
+    if(strcmp(simd, narrow_kernels[i].name) == 0){
+      return width == 1 ? narrow_kernels[i].i8 : narrow_kernels[i].i16;
+    }
+  }
+  return width == 1 ? add_i8_scalar : add_i16_scalar;
+}
+
+// Element i of mat in row major order whatever its layout
+static inline int elem_at(matrix_t *mat, long i){
+  return mat->layout == MATRIX_ROW_MAJOR ? mat->data[i] : mget(mat, i / mat->cols, i % mat->cols);
+}
+
+// Copy mat, which may be in any layout, into nmat in row major order
+// using the narrowest of 1, 2 or 4 byte elements which holds every
+// value. Returns 0 on success and 1 if out of memory.
+int narrow_matrix_from(narrow_matrix_t *nmat, matrix_t mat){
+  long n = mat.rows * mat.cols;
+  int lo = 0, hi = 0;
+  for(long i=0; i<n; i++){
+    int x = elem_at(&mat, i);
+    lo = x < lo ? x : lo;
+    hi = x > hi ? x : hi;
+  }
+  int width = 4;
+  if(lo >= INT8_MIN && hi <= INT8_MAX){
+    width = 1;
+  }
+  else if(lo >= INT16_MIN && hi <= INT16_MAX){
+    width = 2;
+  }
+  void *data = malloc((size_t) width * n);
+  if(data == NULL){
+    printf("narrow_matrix_from: out of memory\n");
+    return 1;
+  }
+  for(long i=0; i<n; i++){
+    switch(width){
+      case 1:  ((int8_t *) data)[i]  = elem_at(&mat, i); break;
+      case 2:  ((int16_t *) data)[i] = elem_at(&mat, i); break;
+      default: ((int32_t *) data)[i] = elem_at(&mat, i); break;
+    }
+  }
+  nmat->rows = mat.rows;
+  nmat->cols = mat.cols;
+  nmat->width = width;
+  nmat->data = data;
+  return 0;
+}
+
+// Frees memory associated with the data field of nmat.
+void narrow_matrix_free_data(narrow_matrix_t *nmat){
+  free(nmat->data);
+  nmat->rows = -1;
+  nmat->cols = -1;
+}
+
+typedef struct {
+  narrow_matrix_t mat;
+  vector_t vec;
+  int *partials;                // partial vectors of workers 1 and up
+  long stride;                  // ints from one partial to the next
+} narrow_job_t;
+
+// Pool task: add worker id's band of packed rows into its partial then
+// tree reduce the partials into vec
+static void narrow_task(void *arg, int id, int nworkers){
+  narrow_job_t *job = (narrow_job_t *) arg;
+  narrow_matrix_t mat = job->mat;
+  narrow_add_fn add = narrow_kernel(mat.width);
+  row_add_fn merge = sumdiag_row_kernel();
+  int *part = id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+  long len = job->vec.len;
+
+  long r0, r1;
+  sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+  PROBE5(sumdiag, worker_start, id, r0, r1, mat.rows, mat.cols);
+  memset(part, 0, sizeof(int) * len);
+  const char *rows = mat.data;
+  for(long r=r0; r<r1; r++){
+    add(&part[mat.rows-1-r], rows + r * mat.cols * mat.width, mat.cols);
+  }
+
+  sumdiag_pool_reduce(part, job->partials, job->stride, len, id, nworkers, merge);
+  PROBE5(sumdiag, worker_end, id, r0, r1, mat.rows, mat.cols);
+}
+
+// Diagonal sums of a narrow matrix into vec with thread_count threads.
+// Returns 0 on success and 1 on error.
+int sumdiag_NARROW(narrow_matrix_t mat, vector_t vec, int thread_count){
+  if(vec.len != (mat.rows + mat.cols - 1)){
+    printf("sumdiag_narrow: bad sizes\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  narrow_job_t job = {mat, vec};
+  job.stride = sumdiag_pool_stride(vec.len);
+  if(thread_count > 1){
+    job.partials = sumdiag_pool_scratch(sizeof(int) * job.stride * (thread_count-1));
+    if(job.partials == NULL){
+      printf("sumdiag_narrow: out of memory\n");
+      return 1;
+    }
+  }
+  if(sumdiag_pool_run(narrow_task, &job, thread_count) != 0){
+    printf("sumdiag_narrow: couldn't start thread pool\n");
+    return 1;
+  }
+  return 0;
+}
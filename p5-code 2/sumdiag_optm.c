@@ -1,7 +1,10 @@
 #include "sumdiag.h"
+#include "probes.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 
 // ==== Matrix Diagonal Sum Benchmark Version 5 ====
 //------ Tuned for ODD grace.umd.edu machines -----
@@ -31,22 +34,33 @@
 //	       TOTAL POINTS: 15 / 30 //
 	      
 
-// Structure to pass necessary data to each thread
+// Static tracepoints, provider 'sumdiag' (see probes.h):
+//   optm_start   (rows, cols, thread_count)
+//   optm_end     (rows, cols, thread_count)
+//   worker_start (worker id, first diagonal, row or tile, one past last, rows, cols)
+//   worker_end   (worker id, first diagonal, row or tile, one past last, rows, cols)
+//   steal_stats  (worker id, tiles run, tiles stolen, failed steals)
+
+// Job shared by all workers; each derives its share from its id
 typedef struct {
-    int start_diag;
-    int end_diag;
     matrix_t mat;
     vector_t vec;
-    pthread_mutex_t *mutex;
-} thread_data_t;
+    int *partials;              // row bands: partial vectors of workers 1 and up
+    long stride;                // ints from one partial to the next
+} diag_job_t;
 
-// Function to calculate sums of specified diagonals of a matrix
-void *calculate_diagonal_sums(void *arg) {
-    thread_data_t *data = (thread_data_t *)arg;
-    matrix_t mat = data->mat;
-    vector_t vec = data->vec;
+// Pool task to calculate the sums of worker id's share of the
+// diagonals. Each diagonal is written by exactly one worker so no lock
+// is needed.
+static void calculate_diagonal_sums(void *arg, int id, int nworkers) {
+    diag_job_t *job = (diag_job_t *)arg;
+    matrix_t mat = job->mat;
+    vector_t vec = job->vec;
+    long start_diag, end_diag;
+    sumdiag_pool_share(vec.len, id, nworkers, &start_diag, &end_diag);
+    PROBE5(sumdiag, worker_start, id, start_diag, end_diag, mat.rows, mat.cols);
 
-    for (int d = data->start_diag; d < data->end_diag; d++) {
+    for (int d = start_diag; d < end_diag; d++) {
         int sum = 0;
         int r, c;
         if (d < mat.rows) {
@@ -61,42 +75,440 @@ void *calculate_diagonal_sums(void *arg) {
             r++;
             c++;
         }
-        pthread_mutex_lock(data->mutex);
         VSET(vec, d, sum);
-        pthread_mutex_unlock(data->mutex);
     }
-    return NULL;
+    PROBE5(sumdiag, worker_end, id, start_diag, end_diag, mat.rows, mat.cols);
 }
 
-// Optimized function to calculate diagonal sums using multiple threads
-int sumdiag_OPTM(matrix_t mat, vector_t vec, int thread_count) {
+// Partial vector of worker id; worker 0 sums straight into vec
+static int *band_partial(diag_job_t *job, int id) {
+    return id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+}
+
+// Set [*lo,*hi) to the part of the result which the rows of bands
+// first to last-1 contribute to
+static void band_window(diag_job_t *job, int first, int last, int nworkers,
+                        long *lo, long *hi) {
+    long r0, r1, junk;
+    sumdiag_pool_share(job->mat.rows, first, nworkers, &r0, &junk);
+    sumdiag_pool_share(job->mat.rows, last-1, nworkers, &junk, &r1);
+    *lo = job->mat.rows - r1;
+    *hi = r1 > r0 ? job->mat.rows - 1 - r0 + job->mat.cols : *lo;
+}
+
+// Tree reduction step: add partial src, holding bands src to end-1,
+// into partial dst over the window those bands cover
+static void band_merge(void *arg, int dst, int src, int end, int nworkers) {
+    diag_job_t *job = (diag_job_t *)arg;
+    long lo, hi;
+    band_window(job, src, end, nworkers, &lo, &hi);
+    sumdiag_row_kernel()(&band_partial(job, dst)[lo], &band_partial(job, src)[lo], hi - lo);
+}
+
+// Pool task for row band partitioning. Worker id sums its band of
+// rows into its own partial vector with the SIMD row kernel; every
+// worker does the same number of elements and writes only its own
+// cache line aligned partial. The partials are then combined with a
+// tree reduction: in the round with step s worker id, a multiple of
+// 2s, adds in the partial of worker id+s. After log2(nworkers) rounds
+// worker 0's partial, which is vec, holds the sums. Each partial is
+// zeroed only over the window of the bands it will absorb.
+static void calculate_band_sums(void *arg, int id, int nworkers) {
+    diag_job_t *job = (diag_job_t *)arg;
+    matrix_t mat = job->mat;
+    row_add_fn add = sumdiag_row_kernel();
+    int *part = band_partial(job, id);
+
+    long r0, r1, lo, hi;
+    sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+    PROBE5(sumdiag, worker_start, id, r0, r1, mat.rows, mat.cols);
+    int span = id == 0 ? nworkers : (id & -id);   // bands absorbed by id
+    int last = id + span < nworkers ? id + span : nworkers;
+    band_window(job, id, last, nworkers, &lo, &hi);
+    if (id == 0) {
+        lo = 0;                 // vec must be fully written
+        hi = job->vec.len;
+    }
+    memset(part + lo, 0, sizeof(int) * (hi - lo));
+    for (long r = r0; r < r1; r++) {
+        add(&part[mat.rows-1-r], &mat.data[r*mat.cols], mat.cols);
+    }
+
+    sumdiag_pool_tree(id, nworkers, band_merge, job);
+    PROBE5(sumdiag, worker_end, id, r0, r1, mat.rows, mat.cols);
+}
+
+// Work stealing: the matrix is cut into tiles of STEAL_TILE_ROWS by
+// STEAL_TILE_COLS which are dealt out as contiguous ranges, one per
+// worker. A worker runs tiles from the front of its own range and when
+// that is empty takes single tiles from the back of other workers'
+// ranges until all are empty. As no tiles are added once the job
+// starts each deque is just a range [head,tail) packed into one 64-bit
+// word so owner and thieves both claim tiles with a compare-and-swap.
+// Tiles go into the worker's partial vector which are then combined
+// with the same tree reduction as row bands.
+#define STEAL_TILE_ROWS 16
+#define STEAL_TILE_COLS 2048
+
+#define RANGE(head,tail)  (((uint64_t) (tail) << 32) | (uint32_t) (head))
+#define RANGE_HEAD(range) ((long) ((range) & 0xFFFFFFFF))
+#define RANGE_TAIL(range) ((long) ((range) >> 32))
+
+// Per worker deque and counters; each on its own cache lines
+typedef struct {
+    uint64_t range;             // tiles [head,tail) not yet claimed
+    uint64_t dealt;             // range first dealt to the worker, for tracing
+    steal_stats_t stats;
+} __attribute__((aligned(64))) steal_worker_t;
+
+typedef struct {
+    matrix_t mat;
+    vector_t vec;
+    int *partials;              // partial vectors of workers 1 and up
+    long stride;                // ints from one partial to the next
+    steal_worker_t *workers;
+    long col_tiles;             // tiles across a row band
+} steal_job_t;
+
+static double now_secs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Claim a tile from the front (owner) or back (thief) of a range.
+// Returns the tile number or -1 if the range is empty.
+static long claim_tile(steal_worker_t *w, int from_back) {
+    uint64_t range = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+    while (1) {
+        long head = RANGE_HEAD(range), tail = RANGE_TAIL(range);
+        if (head >= tail) {
+            return -1;
+        }
+        uint64_t want = from_back ? RANGE(head, tail-1) : RANGE(head+1, tail);
+        if (__atomic_compare_exchange_n(&w->range, &range, want, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return from_back ? tail-1 : head;
+        }
+    }
+}
+
+// Add tile t of the matrix into partial part
+static void run_tile(steal_job_t *job, row_add_fn add, int *part, long t) {
+    matrix_t mat = job->mat;
+    long r0 = (t / job->col_tiles) * STEAL_TILE_ROWS;
+    long c0 = (t % job->col_tiles) * STEAL_TILE_COLS;
+    long r1 = r0 + STEAL_TILE_ROWS < mat.rows ? r0 + STEAL_TILE_ROWS : mat.rows;
+    long c1 = c0 + STEAL_TILE_COLS < mat.cols ? c0 + STEAL_TILE_COLS : mat.cols;
+    for (long r = r0; r < r1; r++) {
+        add(&part[mat.rows-1-r+c0], &mat.data[r*mat.cols+c0], c1-c0);
+    }
+}
+
+// Pool task for work stealing
+static void calculate_stolen_sums(void *arg, int id, int nworkers) {
+    steal_job_t *job = (steal_job_t *)arg;
+    row_add_fn add = sumdiag_row_kernel();
+    steal_worker_t *me = &job->workers[id];
+    int *part = id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+    long len = job->vec.len;
+    PROBE5(sumdiag, worker_start, id, RANGE_HEAD(me->dealt), RANGE_TAIL(me->dealt),
+           job->mat.rows, job->mat.cols);
+    memset(part, 0, sizeof(int) * len);
+
+    long t;
+    while ((t = claim_tile(me, 0)) != -1) {
+        run_tile(job, add, part, t);
+        me->stats.tiles++;
+    }
+    double idle_start = now_secs();
+    for (int found = 1; found; ) {
+        found = 0;
+        for (int v = 1; v < nworkers; v++) {
+            steal_worker_t *victim = &job->workers[(id + v) % nworkers];
+            t = claim_tile(victim, 1);
+            if (t == -1) {
+                me->stats.failed++;
+                continue;
+            }
+            me->stats.idle += now_secs() - idle_start;
+            run_tile(job, add, part, t);
+            me->stats.tiles++;
+            me->stats.steals++;
+            idle_start = now_secs();
+            found = 1;
+            break;
+        }
+    }
+
+    sumdiag_pool_barrier();     // idle includes waiting for the last tiles
+    me->stats.idle += now_secs() - idle_start;
+    sumdiag_pool_reduce(part, job->partials, job->stride, len, id, nworkers, add);
+    PROBE4(sumdiag, steal_stats, id, me->stats.tiles, me->stats.steals, me->stats.failed);
+    PROBE5(sumdiag, worker_end, id, RANGE_HEAD(me->dealt), RANGE_TAIL(me->dealt),
+           job->mat.rows, job->mat.cols);
+}
+
+// Calculate diagonal sums with thread_count threads balancing tiles by
+// work stealing. If stats is not NULL it must have room for
+// thread_count entries which are filled with each worker's counts of
+// tiles run, tiles stolen, failed steal attempts and seconds spent
+// idle. Returns 0 on success and 1 on error.
+int sumdiag_OPTM_steal(matrix_t mat, vector_t vec, int thread_count,
+                       steal_stats_t *stats) {
     if (vec.len != (mat.rows + mat.cols - 1)) {
         printf("sumdiag_optm: size mismatch\n");
         return 1;
     }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (mat.layout != MATRIX_ROW_MAJOR) {
+        printf("sumdiag_optm: bad layout\n");
+        return 1;
+    }
+    PROBE3(sumdiag, optm_start, mat.rows, mat.cols, thread_count);
 
-    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
-    thread_data_t *thread_data = malloc(thread_count * sizeof(thread_data_t));
-    pthread_mutex_t mutex;
-    pthread_mutex_init(&mutex, NULL);
+    steal_job_t job = {mat, vec, NULL, 0, NULL, 0};
+    job.col_tiles = (mat.cols + STEAL_TILE_COLS - 1) / STEAL_TILE_COLS;
+    long tiles = (mat.rows + STEAL_TILE_ROWS - 1) / STEAL_TILE_ROWS * job.col_tiles;
+    job.stride = sumdiag_pool_stride(vec.len);
+    size_t worker_bytes = sizeof(steal_worker_t) * thread_count;
+    char *scratch = sumdiag_pool_scratch(worker_bytes + sizeof(int) * job.stride * (thread_count-1));
+    if (scratch == NULL) {
+        printf("sumdiag_optm: out of memory\n");
+        return 1;
+    }
+    job.workers = (steal_worker_t *) scratch;
+    job.partials = (int *) (scratch + worker_bytes);
+    for (int i = 0; i < thread_count; i++) {
+        long head, tail;
+        sumdiag_pool_share(tiles, i, thread_count, &head, &tail);
+        job.workers[i] = (steal_worker_t) {RANGE(head, tail), RANGE(head, tail), {0, 0, 0, 0.0}};
+    }
 
-    int diags = mat.rows + mat.cols - 1;
-    int diags_per_thread = diags / thread_count;
-    int extra_diags = diags % thread_count;
+    if (sumdiag_pool_run(calculate_stolen_sums, &job, thread_count) != 0) {
+        printf("sumdiag_optm: couldn't start thread pool\n");
+        return 1;
+    }
+    for (int i = 0; stats != NULL && i < thread_count; i++) {
+        stats[i] = job.workers[i].stats;
+    }
+    PROBE3(sumdiag, optm_end, mat.rows, mat.cols, thread_count);
+    return 0;
+}
 
+// Print a table of the statistics from sumdiag_OPTM_steal()
+void steal_stats_print(FILE *file, steal_stats_t *stats, int thread_count) {
+    fprintf(file, "%6s %8s %8s %8s %10s\n", "WORKER", "TILES", "STEALS", "FAILED", "IDLE_SECS");
     for (int i = 0; i < thread_count; i++) {
-        int start_diag = i * diags_per_thread + (i < extra_diags ? i : extra_diags);
-        int end_diag = start_diag + diags_per_thread + (i < extra_diags ? 1 : 0);
-        thread_data[i] = (thread_data_t){start_diag, end_diag, mat, vec, &mutex};
-        pthread_create(&threads[i], NULL, calculate_diagonal_sums, &thread_data[i]);
+        fprintf(file, "%6d %8ld %8ld %8ld %10.6f\n", i, stats[i].tiles,
+                stats[i].steals, stats[i].failed, stats[i].idle);
     }
+}
 
-    for (int i = 0; i < thread_count; i++) {
-        pthread_join(threads[i], NULL);
+// Cache blocking: the matrix is cut into square tiles of
+// sumdiag_tile_size() which are claimed in turn from a shared counter
+// by the workers. A tile of h rows and w cols has h+w-1 local
+// diagonals which are summed with the row kernel into a small buffer
+// that stays in L1 while the tile's rows stream through L2; the
+// buffer is then added into the worker's partial at the offset of the
+// tile's lowest diagonal. Partials are combined by tree reduction.
+typedef struct {
+    matrix_t mat;
+    vector_t vec;
+    int *partials;              // partial vectors of workers 1 and up
+    long stride;                // ints from one partial to the next
+    int *locals;                // per worker local sums, local_stride apart
+    long local_stride;
+    long tile;                  // tile edge in elements
+    long col_tiles;             // tiles across the matrix
+    long tiles;                 // total tiles
+    long next;                  // next tile to claim
+} tile_job_t;
+
+static long tile_edge = 0;      // 0 until detected or set; atomic access only
+static pthread_once_t tile_once = PTHREAD_ONCE_INIT;
+
+// Size in bytes of the L2 cache of cpu0 from sysfs, 0 if unknown
+static long l2_cache_bytes() {
+    for (int i = 0; i < 16; i++) {
+        char path[128], type[32];
+        int level = 0;
+        long size = 0;
+        char unit = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+        int ok = fscanf(f, "%d", &level) == 1;
+        fclose(f);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        f = fopen(path, "r");
+        ok = ok && f != NULL && fscanf(f, "%31s", type) == 1;
+        if (f != NULL) {
+            fclose(f);
+        }
+        if (!ok || level != 2 || strcmp(type, "Instruction") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        f = fopen(path, "r");
+        if (f != NULL && fscanf(f, "%ld%c", &size, &unit) >= 1) {
+            size *= unit == 'K' ? 1024 : unit == 'M' ? 1024*1024 : 1;
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        return size;
     }
+    return 0;
+}
 
-    pthread_mutex_destroy(&mutex);
-    free(threads);
-    free(thread_data);
+// Pick a tile edge so a tile fills about half of L2 leaving room for
+// the partial vector; SUMDIAG_TILE in the environment overrides.
+static long tile_detect_edge() {
+    char *env = getenv("SUMDIAG_TILE");
+    if (env != NULL && atol(env) > 0) {
+        return atol(env);
+    }
+    long l2 = l2_cache_bytes();
+    if (l2 <= 0) {
+        l2 = 256 * 1024;        // common L2 size if sysfs is missing
+    }
+    long edge = (long) sqrt(l2 / 2 / sizeof(int)) / 16 * 16;
+    return edge < 16 ? 16 : edge;
+}
+
+// Detect the tile edge unless it has been set explicitly
+static void tile_detect() {
+    long unset = 0;
+    __atomic_compare_exchange_n(&tile_edge, &unset, tile_detect_edge(), 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// Return the tile edge in elements used by SUMDIAG_PART_TILES. Each
+// call of sumdiag_OPTM() reads it once into its job so workers never
+// see it change mid-run.
+long sumdiag_tile_size() {
+    pthread_once(&tile_once, tile_detect);
+    return __atomic_load_n(&tile_edge, __ATOMIC_RELAXED);
+}
+
+// Set the tile edge used by SUMDIAG_PART_TILES; 0 detects it again
+// from the cache sizes. Safe to call while other threads sum.
+void sumdiag_set_tile_size(long tile) {
+    __atomic_store_n(&tile_edge, tile > 0 ? tile : tile_detect_edge(), __ATOMIC_RELAXED);
+}
+
+// Pool task for cache blocked tiles
+static void calculate_tile_sums(void *arg, int id, int nworkers) {
+    tile_job_t *job = (tile_job_t *)arg;
+    matrix_t mat = job->mat;
+    row_add_fn add = sumdiag_row_kernel();
+    int *part = id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+    int *local = job->locals + id * job->local_stride;
+    PROBE5(sumdiag, worker_start, id, 0, job->tiles, mat.rows, mat.cols); // shared tiles
+    memset(part, 0, sizeof(int) * job->vec.len);
+
+    long t;
+    while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->tiles) {
+        long r0 = (t / job->col_tiles) * job->tile;
+        long c0 = (t % job->col_tiles) * job->tile;
+        long h = r0 + job->tile < mat.rows ? job->tile : mat.rows - r0;
+        long w = c0 + job->tile < mat.cols ? job->tile : mat.cols - c0;
+        memset(local, 0, sizeof(int) * (h + w - 1));
+        for (long i = 0; i < h; i++) {
+            add(&local[h-1-i], &mat.data[(r0+i)*mat.cols + c0], w);
+        }
+        add(&part[mat.rows - r0 - h + c0], local, h + w - 1);
+    }
+
+    sumdiag_pool_reduce(part, job->partials, job->stride, job->vec.len, id, nworkers, add);
+    PROBE5(sumdiag, worker_end, id, 0, job->tiles, mat.rows, mat.cols);
+}
+
+// Calculate diagonal sums over square tiles sized to the L2 cache
+// using thread_count threads. Returns 0 on success and 1 on error.
+static int sumdiag_OPTM_tiles(matrix_t mat, vector_t vec, int thread_count) {
+    tile_job_t job = {mat, vec};
+    job.tile = sumdiag_tile_size();
+    job.col_tiles = (mat.cols + job.tile - 1) / job.tile;
+    job.tiles = (mat.rows + job.tile - 1) / job.tile * job.col_tiles;
+    job.stride = sumdiag_pool_stride(vec.len);
+    job.local_stride = sumdiag_pool_stride(2 * job.tile);
+    size_t partial_ints = job.stride * (thread_count-1);
+    int *scratch = sumdiag_pool_scratch(sizeof(int) * (partial_ints + job.local_stride * thread_count));
+    if (scratch == NULL) {
+        printf("sumdiag_optm: out of memory\n");
+        return 1;
+    }
+    job.partials = scratch;
+    job.locals = scratch + partial_ints;
+    if (sumdiag_pool_run(calculate_tile_sums, &job, thread_count) != 0) {
+        printf("sumdiag_optm: couldn't start thread pool\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Optimized function to calculate diagonal sums using multiple threads
+// split by rows; see sumdiag_OPTM_part().
+int sumdiag_OPTM(matrix_t mat, vector_t vec, int thread_count) {
+    return sumdiag_OPTM_part(mat, vec, thread_count, SUMDIAG_PART_ROWS);
+}
+
+// Calculate diagonal sums with thread_count threads dividing the work
+// according to part:
+//   SUMDIAG_PART_ROWS  bands of rows summed into private partial
+//                      vectors which are then reduced
+//   SUMDIAG_PART_DIAGS ranges of whole diagonals written to vec
+//   SUMDIAG_PART_STEAL tiles balanced by work stealing
+//   SUMDIAG_PART_TILES L2 sized square tiles
+// Workers come from the persistent pool in sumdiag_pool.c so no
+// threads are created per call. Returns 0 on success and 1 on error.
+int sumdiag_OPTM_part(matrix_t mat, vector_t vec, int thread_count, int part) {
+    if (vec.len != (mat.rows + mat.cols - 1)) {
+        printf("sumdiag_optm: size mismatch\n");
+        return 1;
+    }
+    if (mat.layout != MATRIX_ROW_MAJOR) {
+        // other layouts have their own kernels
+        return sumdiag_LAYOUT(mat, vec, thread_count);
+    }
+    if (part == SUMDIAG_PART_STEAL) {
+        return sumdiag_OPTM_steal(mat, vec, thread_count, NULL);
+    }
+    PROBE3(sumdiag, optm_start, mat.rows, mat.cols, thread_count);
+
+    if (part == SUMDIAG_PART_TILES) {
+        int ret = sumdiag_OPTM_tiles(mat, vec, thread_count < 1 ? 1 : thread_count);
+        PROBE3(sumdiag, optm_end, mat.rows, mat.cols, thread_count);
+        return ret;
+    }
+    if (thread_count <= 1) {
+        // one thread: stream the rows through the SIMD kernel
+        sumdiag_ROWS(mat, vec);
+        PROBE3(sumdiag, optm_end, mat.rows, mat.cols, thread_count);
+        return 0;
+    }
+
+    diag_job_t job = {mat, vec, NULL, 0};
+    pool_task_fn task = calculate_diagonal_sums;
+    if (part == SUMDIAG_PART_ROWS) {
+        job.stride = sumdiag_pool_stride(vec.len);
+        job.partials = sumdiag_pool_scratch(sizeof(int) * job.stride * (thread_count-1));
+        if (job.partials == NULL) {
+            printf("sumdiag_optm: out of memory\n");
+            return 1;
+        }
+        task = calculate_band_sums;
+    }
+    if (sumdiag_pool_run(task, &job, thread_count) != 0) {
+        printf("sumdiag_optm: couldn't start thread pool\n");
+        return 1;
+    }
+    PROBE3(sumdiag, optm_end, mat.rows, mat.cols, thread_count);
     return 0;
 }
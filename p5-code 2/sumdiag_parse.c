@@ -0,0 +1,302 @@
+// sumdiag_parse.c: fast parsing of the text matrix and vector formats.
+//
+// fscanf parses a few MB/s on one core. sumdiag_parse_file() maps the
+// file, or reads it if it can't be mapped as with pipes, and parses
+// the whitespace separated integers after the header in parallel:
+//
+//   1. the text is cut into one chunk per worker, each boundary moved
+//      forward to whitespace so no number is split
+//   2. each worker counts the numbers in its chunk and after a barrier
+//      sums the counts of the chunks before it, giving the index of its
+//      first number in the output
+//   3. each worker parses its chunk straight into place, converting 8
+//      digits at a time with SWAR arithmetic on a 64-bit word
+//
+// Bad numbers, ints out of range, header dimensions over INT_MAX or
+// whose product can't be allocated and too few or too many elements are
+// reported with the line they occur on and an error is returned rather
+// than asserting.
+
+#include "sumdiag.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes of text per worker below which more workers don't pay off
+#define PARSE_MIN_CHUNK (256 * 1024)
+
+typedef struct {
+  const char *text;
+  long len;
+  int mapped;                   // text is mmap'd rather than malloc'd
+} text_t;
+
+// Is c whitespace as for isspace() in the C locale
+static inline int is_ws(char c){
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Map fname or, if it can't be mapped, read all of it. Returns 0 on
+// success and 1 on error.
+static int text_load(char *fname, text_t *t){
+  int fd = open(fname, O_RDONLY);
+  if(fd < 0){
+    perror("couldn't open file");
+    return 1;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(base != MAP_FAILED){
+      madvise(base, st.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      *t = (text_t){base, st.st_size, 1};
+      return 0;
+    }
+  }
+  long cap = 1 << 16, len = 0;
+  char *buf = malloc(cap);
+  for(long got=1; buf != NULL && got > 0; len += got){
+    if(len == cap){
+      char *bigger = realloc(buf, 2*cap);
+      if(bigger == NULL){
+        free(buf);
+        buf = NULL;
+        break;
+      }
+      buf = bigger;
+      cap *= 2;
+    }
+    got = read(fd, buf + len, cap - len);
+    if(got < 0){
+      perror("couldn't read file");
+      free(buf);
+      close(fd);
+      return 1;
+    }
+  }
+  close(fd);
+  if(buf == NULL){
+    printf("%s: out of memory\n",fname);
+    return 1;
+  }
+  *t = (text_t){buf, len, 0};
+  return 0;
+}
+
+static void text_release(text_t *t){
+  if(t->mapped){
+    munmap((void *) t->text, t->len);
+  }
+  else{
+    free((void *) t->text);
+  }
+}
+
+// 1-based line number of byte pos of text
+static long text_line(const char *text, long pos){
+  long line = 1;
+  for(long i=0; i<pos; i++){
+    line += text[i] == '\n';
+  }
+  return line;
+}
+
+// Are all 8 bytes of x ASCII digits: each byte's high nibble must be 3
+// both as is and after adding 6, which carries into it for ':' and up
+static inline int swar_all_digits(uint64_t x){
+  return (((x & 0xF0F0F0F0F0F0F0F0ULL) |
+           (((x + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+          == 0x3333333333333333ULL);
+}
+
+// Value of 8 ASCII digits loaded little endian, first digit lowest:
+// combine neighbouring digits, then pairs, then quads
+static inline uint64_t swar_eight_digits(uint64_t x){
+  x -= 0x3030303030303030ULL;
+  x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FFULL;
+  x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFFULL;
+  return (x * 10000 + (x >> 32)) & 0x00000000FFFFFFFFULL;
+}
+
+// Parse an optionally signed decimal number of at most max_digits
+// digits at *pp which must be followed by whitespace or end. Reads of
+// 8 bytes at a time may look past the number but not past end.
+// Advances *pp and returns 0 on success; returns 1 on a malformed or
+// too long number.
+static int parse_number(const char **pp, const char *end, int max_digits, long *val){
+  const char *p = *pp;
+  int neg = 0;
+  if(p < end && (*p == '-' || *p == '+')){
+    neg = *p == '-';
+    p++;
+  }
+  const char *digits = p;
+  uint64_t v = 0;
+  while(p + 8 <= end){
+    uint64_t word;
+    memcpy(&word, p, 8);
+    if(!swar_all_digits(word)){
+      break;
+    }
+    v = v * 100000000 + swar_eight_digits(word);
+    p += 8;
+    if(p - digits > max_digits){
+      return 1;
+    }
+  }
+  while(p < end && *p >= '0' && *p <= '9'){
+    v = v * 10 + (*p - '0');
+    p++;
+  }
+  if(p == digits || p - digits > max_digits || (p < end && !is_ws(*p))){
+    return 1;
+  }
+  *val = neg ? -(long) v : (long) v;
+  *pp = p;
+  return 0;
+}
+
+typedef struct {
+  const char *text;
+  long len;                     // bytes of text
+  long first;                   // offset of the first number
+  int *data;
+  long n;                       // numbers expected
+  long *counts;                 // numbers in each worker's chunk
+  long *errors;                 // offset of each worker's first error or -1
+} parse_job_t;
+
+// Start of worker id's chunk: its nominal start moved up to whitespace
+static long chunk_begin(parse_job_t *job, int id, int nworkers){
+  if(id == 0){
+    return job->first;
+  }
+  if(id == nworkers){
+    return job->len;
+  }
+  long p = job->first + (job->len - job->first) * id / nworkers;
+  while(p < job->len && !is_ws(job->text[p])){
+    p++;
+  }
+  return p;
+}
+
+// Pool task: count the numbers in worker id's chunk, find its first
+// index from the counts before it then parse the chunk into place
+static void parse_task(void *arg, int id, int nworkers){
+  parse_job_t *job = (parse_job_t *) arg;
+  const char *text = job->text, *end = text + job->len;
+  long beg = chunk_begin(job, id, nworkers);
+  long stop = chunk_begin(job, id+1, nworkers);
+
+  long count = 0;
+  for(long i=beg; i<stop; i++){         // starts of whitespace separated runs
+    count += !is_ws(text[i]) && (i == beg || is_ws(text[i-1]));
+  }
+  job->counts[id] = count;
+  job->errors[id] = -1;
+  sumdiag_pool_barrier();
+
+  long index = 0;
+  for(int w=0; w<id; w++){
+    index += job->counts[w];
+  }
+  const char *p = text + beg, *q = text + stop;
+  while(p < q){
+    if(is_ws(*p)){
+      p++;
+      continue;
+    }
+    long val;
+    const char *num = p;
+    if(parse_number(&p, end, 10, &val) != 0 || val < INT_MIN || val > INT_MAX){
+      job->errors[id] = num - text;
+      return;
+    }
+    if(index < job->n){                 // extra numbers are reported after
+      job->data[index] = val;
+    }
+    index++;
+  }
+}
+
+// Number of workers for len bytes of text
+static int parse_threads(long len){
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long want = len / PARSE_MIN_CHUNK + 1;
+  want = want < cpus ? want : cpus;
+  return want < 1 ? 1 : want > 64 ? 64 : want;
+}
+
+// Parse the text file fname holding nheader positive longs followed by
+// as many ints as the product of the header values, storing the header
+// in header[] and setting *data_ref to a malloc'd array of the ints.
+// Returns 0 on success and 1 on errors which are reported on stdout.
+int sumdiag_parse_file(char *fname, int nheader, long *header, int **data_ref){
+  text_t t;
+  if(text_load(fname, &t) != 0){
+    return 1;
+  }
+  const char *p = t.text, *end = t.text + t.len;
+  long n = 1;
+  for(int h=0; h<nheader; h++){
+    while(p < end && is_ws(*p)){
+      p++;
+    }
+    if(parse_number(&p, end, 18, &header[h]) != 0 || header[h] <= 0){
+      printf("%s: bad header on line %ld\n",fname,text_line(t.text, p - t.text));
+      text_release(&t);
+      return 1;
+    }
+    if(header[h] > INT_MAX || header[h] > LONG_MAX / n ||
+       (unsigned long) (n * header[h]) > SIZE_MAX / sizeof(int))
+    {                                   // no allocation could hold the data
+      printf("%s: header too large on line %ld\n",fname,text_line(t.text, p - t.text));
+      text_release(&t);
+      return 1;
+    }
+    n *= header[h];
+  }
+
+  int nworkers = parse_threads(end - p);
+  parse_job_t job = {t.text, t.len, p - t.text, malloc(sizeof(int) * n), n};
+  job.counts = malloc(sizeof(long) * nworkers);
+  job.errors = malloc(sizeof(long) * nworkers);
+  int ret = job.data == NULL || job.counts == NULL || job.errors == NULL;
+  if(ret){
+    printf("%s: out of memory\n",fname);
+  }
+  else if(sumdiag_pool_run(parse_task, &job, nworkers) != 0){
+    printf("%s: couldn't start thread pool\n",fname);
+    ret = 1;
+  }
+  long total = 0;
+  for(int w=0; !ret && w<nworkers; w++){
+    if(job.errors[w] >= 0){
+      long pos = job.errors[w], e = pos;
+      while(e < t.len && !is_ws(t.text[e]) && e - pos < 20){
+        e++;
+      }
+      printf("%s: bad element '%.*s' on line %ld\n",fname,(int) (e - pos),
+             t.text + pos, text_line(t.text, pos));
+      ret = 1;
+    }
+    total += job.counts[w];
+  }
+  if(!ret && total != n){
+    printf("%s: expected %ld elements but found %ld\n",fname,n,total);
+    ret = 1;
+  }
+  free(job.counts);
+  free(job.errors);
+  text_release(&t);
+  if(ret){
+    free(job.data);
+    return 1;
+  }
+  *data_ref = job.data;
+  return 0;
+}
@@ -0,0 +1,269 @@
+// sumdiag_pool.c: persistent worker threads for sumdiag_OPTM().
+//
+// Creating and joining threads on every call costs tens of
+// microseconds per thread which is a sizable share of the run time
+// for mid-sized matrices. The pool creates its threads once and parks
+// them on a condition variable between jobs. A job is a function and
+// a context pointer; sumdiag_pool_run() publishes them, bumps the job
+// generation to wake the workers, runs worker 0's share on the calling
+// thread and then waits for the others to finish. Dispatch does no
+// allocation so a call costs one wake-up and one barrier.
+//
+//   sumdiag_pool_init(4);                  // optional, else done lazily
+//   sumdiag_pool_run(task, &ctx, 4);       // task(&ctx, id, 4) for id 0..3
+//   sumdiag_pool_shutdown();               // join threads before exit
+//
+// Tasks which work in phases call sumdiag_pool_barrier() between them
+// and may use sumdiag_pool_scratch() for per-job buffers which are
+// kept between calls. Only one thread may dispatch jobs at a time.
+
+#include "sumdiag.h"
+#include <sched.h>
+
+static void pool_stop_threads();
+
+static struct {
+  int nthreads;                 // workers including the caller, 0 if not started
+  pthread_t *threads;           // nthreads-1 helper threads
+  pthread_mutex_t lock;
+  pthread_cond_t start;         // signalled when a job is posted
+  pthread_cond_t done;          // signalled when the last worker finishes
+  unsigned long generation;     // bumped once per job
+  int pending;                  // helpers still running the current job
+  int shutdown;                 // set to make helpers exit
+  pool_task_fn task;            // current job
+  void *ctx;
+  int nworkers;                 // workers taking part in the current job
+  int barrier_count;            // workers yet to reach the barrier
+  int barrier_sense;            // flipped each time the barrier opens
+  void *scratch;                // buffer from sumdiag_pool_scratch()
+  size_t scratch_bytes;
+} pool = {
+  .lock  = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done  = PTHREAD_COND_INITIALIZER,
+};
+
+// Loop run by helper thread id: wait for a new generation, run the
+// task if this worker takes part and report completion.
+static void *pool_worker(void *arg){
+  int id = (int) (long) arg;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&pool.lock);
+  while(1){
+    while(pool.generation == seen && !pool.shutdown){
+      pthread_cond_wait(&pool.start, &pool.lock);
+    }
+    if(pool.shutdown){
+      break;
+    }
+    seen = pool.generation;
+    pool_task_fn task = pool.task;
+    void *ctx = pool.ctx;
+    int nworkers = pool.nworkers;
+    pthread_mutex_unlock(&pool.lock);
+
+    if(id < nworkers){
+      task(ctx, id, nworkers);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.pending--;
+    if(pool.pending == 0){
+      pthread_cond_signal(&pool.done);
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+// Start a pool of nthreads workers counting the calling thread which
+// acts as worker 0. The threads of an existing pool of a different
+// size are stopped first. Returns 0 on success and 1 if the thread
+// array can't be allocated or threads can't be created.
+int sumdiag_pool_init(int nthreads){
+  if(nthreads < 1){
+    nthreads = 1;
+  }
+  if(pool.nthreads == nthreads){
+    return 0;
+  }
+  pool_stop_threads();
+
+  pool.threads = malloc(sizeof(pthread_t) * (nthreads-1));
+  if(pool.threads == NULL && nthreads > 1){
+    return 1;                   // pool stays stopped
+  }
+  pool.shutdown = 0;
+  pool.generation = 0;
+  for(int i=1; i<nthreads; i++){
+    if(pthread_create(&pool.threads[i-1], NULL, pool_worker, (void *) (long) i) != 0){
+      pool.nthreads = i;        // stop the ones that started
+      pool_stop_threads();
+      return 1;
+    }
+  }
+  pool.nthreads = nthreads;
+  return 0;
+}
+
+// Stop and join the helper threads of a running pool
+static void pool_stop_threads(){
+  if(pool.nthreads == 0){
+    return;
+  }
+  pthread_mutex_lock(&pool.lock);
+  pool.shutdown = 1;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+  for(int i=1; i<pool.nthreads; i++){
+    pthread_join(pool.threads[i-1], NULL);
+  }
+  free(pool.threads);
+  pool.threads = NULL;
+  pool.nthreads = 0;
+}
+
+// Stop and join all helper threads and free the scratch buffer. Safe
+// to call when no pool is running; a later sumdiag_pool_run() starts a
+// new one.
+void sumdiag_pool_shutdown(){
+  pool_stop_threads();
+  free(pool.scratch);
+  pool.scratch = NULL;
+  pool.scratch_bytes = 0;
+}
+
+// Number of workers in the running pool including the caller, 0 if
+// the pool has not been started.
+int sumdiag_pool_size(){
+  return pool.nthreads;
+}
+
+// Run task(ctx, id, nworkers) for id 0 to nworkers-1 in parallel and
+// return once all have finished. The caller runs id 0. Starts or
+// enlarges the pool if it has fewer than nworkers threads; a larger
+// pool is reused with the extra workers sitting out the job. Returns
+// 0 on success and 1 if the pool could not be started.
+int sumdiag_pool_run(pool_task_fn task, void *ctx, int nworkers){
+  if(nworkers <= 1){
+    pool.nworkers = 1;          // so the barrier is a no-op
+    pool.barrier_count = 1;
+    task(ctx, 0, 1);
+    return 0;
+  }
+  if(pool.nthreads < nworkers && sumdiag_pool_init(nworkers) != 0){
+    return 1;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.task = task;
+  pool.ctx = ctx;
+  pool.nworkers = nworkers;
+  pool.barrier_count = nworkers;
+  pool.pending = pool.nthreads - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  task(ctx, 0, nworkers);
+
+  pthread_mutex_lock(&pool.lock);
+  while(pool.pending > 0){
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return 0;
+}
+
+// Wait until all workers of the current job reach the barrier. Called
+// from within a task by every worker the same number of times. Spins
+// briefly then yields as workers may outnumber the cores.
+void sumdiag_pool_barrier(){
+  int sense = __atomic_load_n(&pool.barrier_sense, __ATOMIC_ACQUIRE);
+  if(__atomic_sub_fetch(&pool.barrier_count, 1, __ATOMIC_ACQ_REL) == 0){
+    pool.barrier_count = pool.nworkers;
+    __atomic_store_n(&pool.barrier_sense, !sense, __ATOMIC_RELEASE);
+    return;
+  }
+  for(int spins=0; __atomic_load_n(&pool.barrier_sense, __ATOMIC_ACQUIRE) == sense; spins++){
+    if(spins >= 100){
+      sched_yield();
+    }
+  }
+}
+
+// Return a cache line aligned buffer of at least bytes which stays
+// owned by the pool and is reused by later calls; contents are not
+// preserved when it grows. Call before sumdiag_pool_run() rather than
+// from inside a task. Returns NULL if out of memory.
+void *sumdiag_pool_scratch(size_t bytes){
+  if(bytes > pool.scratch_bytes){
+    free(pool.scratch);
+    bytes = (bytes + 63) / 64 * 64;
+    pool.scratch = aligned_alloc(64, bytes);
+    pool.scratch_bytes = pool.scratch == NULL ? 0 : bytes;
+  }
+  return pool.scratch;
+}
+
+// Split n items into nworkers nearly equal ranges and set [*beg,*end)
+// to the range of worker id
+void sumdiag_pool_share(long n, int id, int nworkers, long *beg, long *end){
+  long per = n / nworkers;
+  long extra = n % nworkers;
+  *beg = id * per + (id < extra ? id : extra);
+  *end = *beg + per + (id < extra ? 1 : 0);
+}
+
+// Length rounded up to whole 64 byte cache lines of ints: the stride
+// between per worker partial vectors so no two workers share a line
+long sumdiag_pool_stride(long len){
+  return sumdiag_pool_stride_of(len, sizeof(int));
+}
+
+// As sumdiag_pool_stride() for partials of elements of size bytes,
+// which must divide 64
+long sumdiag_pool_stride_of(long len, size_t size){
+  long per_line = 64 / size;
+  return (len + per_line - 1) / per_line * per_line;
+}
+
+// Tree reduction of per worker results, called by every worker of a
+// task once its own result is ready. In each round after a barrier,
+// worker id with id a multiple of 2*step merges in the result of
+// worker src = id+step, which by then covers workers src to end-1
+// with end = min(src+step, nworkers), by calling merge(ctx, id, src,
+// end, nworkers). Worker 0 ends up with the merge of all results in
+// log2(nworkers) rounds.
+void sumdiag_pool_tree(int id, int nworkers, pool_merge_fn merge, void *ctx){
+  for(int step=1; step<nworkers; step*=2){
+    sumdiag_pool_barrier();
+    if(id % (2*step) == 0 && id + step < nworkers){
+      int src = id + step;
+      merge(ctx, id, src, src + step < nworkers ? src + step : nworkers, nworkers);
+    }
+  }
+}
+
+typedef struct {
+  int *part;
+  int *partials;
+  long stride;
+  long len;
+  row_add_fn add;
+} reduce_ctx_t;
+
+static void reduce_merge(void *arg, int dst, int src, int end, int nworkers){
+  reduce_ctx_t *ctx = (reduce_ctx_t *) arg;
+  ctx->add(ctx->part, ctx->partials + (src-1) * ctx->stride, ctx->len);
+}
+
+// sumdiag_pool_tree() for the usual layout of partial vectors: worker
+// 0 sums into the output, passed as its part, and worker id > 0 into
+// part = partials + (id-1)*stride, each len ints merged with add.
+void sumdiag_pool_reduce(int *part, int *partials, long stride, long len,
+                         int id, int nworkers, row_add_fn add){
+  reduce_ctx_t ctx = {part, partials, stride, len, add};
+  sumdiag_pool_tree(id, nworkers, reduce_merge, &ctx);
+}
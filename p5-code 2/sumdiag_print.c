@@ -2,9 +2,19 @@
 
 int main(int argc, char *argv[]){
   if(argc < 3){
-    printf("usage: %s <size> <thread_count>\n",argv[0]);
+    printf("usage: %s <size> <thread_count> [rows|diags|steal|tiles]\n",argv[0]);
     exit(1);
   }
+  int part = SUMDIAG_PART_ROWS;             // how OPTM divides the work
+  if(argc > 3 && strcmp(argv[3],"diags")==0){
+    part = SUMDIAG_PART_DIAGS;
+  }
+  if(argc > 3 && strcmp(argv[3],"steal")==0){
+    part = SUMDIAG_PART_STEAL;
+  }
+  if(argc > 3 && strcmp(argv[3],"tiles")==0){
+    part = SUMDIAG_PART_TILES;
+  }
 
   printf("==== Matrix Diagonal Sum Print ====\n");
   long size = atoi(argv[1]);
@@ -21,9 +31,21 @@ int main(int argc, char *argv[]){
 
   vector_init(&res_BASE, 2*size-1);
   vector_init(&res_OPTM, 2*size-1);
-  
+
   sumdiag_BASE(mat,res_BASE);               // call baseline algorithm
-  sumdiag_OPTM(mat,res_OPTM, thread_count); // call optimized algorithm
+  steal_stats_t *stats = NULL;              // per worker counts on stderr
+  int nstats = thread_count < 1 ? 1 : thread_count; // OPTM runs at least 1
+  if(part == SUMDIAG_PART_STEAL && getenv("SUMDIAG_STATS") != NULL){
+    stats = malloc(sizeof(steal_stats_t) * nstats);
+  }
+  if(stats != NULL){                        // same run, counting as it goes
+    sumdiag_OPTM_steal(mat,res_OPTM, thread_count, stats);
+    steal_stats_print(stderr, stats, nstats);
+    free(stats);
+  }
+  else{
+    sumdiag_OPTM_part(mat,res_OPTM, thread_count, part); // call optimized algorithm
+  }
 
   printf("Diagnonal Sums:\n");
   printf("[ i]: BASE OPTM\n");
@@ -33,9 +55,10 @@ int main(int argc, char *argv[]){
     char *diff = (b != o) ? "***" : "";
     printf("[%2d]: %4d %4d %s\n",i,b,o,diff);
   }
-    
+
   matrix_free_data(&mat);       // clean up data
   vector_free_data(&res_BASE);
   vector_free_data(&res_OPTM);
+  sumdiag_pool_shutdown();      // join the worker threads
   return 0;
 }
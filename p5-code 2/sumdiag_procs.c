@@ -0,0 +1,144 @@
+// sumdiag_procs.c: diagonal sums split across processes.
+//
+// Threads stop at the edge of one process. sumdiag_PROCS() is a
+// coordinator which maps a binary matrix file written by
+// matrix_write_binary() and forks worker processes. Each worker sums
+// a band of rows into its own partial vector in an anonymous shared
+// mapping and exits; the coordinator waits for all of them, checks
+// their exit status and reduces the partials. Workers only read the
+// matrix so the pages of the file mapping are shared, not copied, and
+// they could as well be started separately with their own mapping of
+// the file as its name is all they need.
+//
+// A matrix in memory is put in a POSIX shared memory segment with
+// matrix_to_shm(), which writes it in the binary format so the
+// segment's path under /dev/shm works wherever a binary file does.
+
+#include "sumdiag.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Most worker processes one call forks
+#define PROCS_MAX 256
+
+// Sum rows r0 to r1-1 of mat into part, which has room for all the
+// diagonals and is zero
+static void procs_band(matrix_t *mat, int *part, long r0, long r1){
+  row_add_fn add = sumdiag_row_kernel();
+  for(long r=r0; r<r1; r++){
+    if(mat->layout == MATRIX_ROW_MAJOR){
+      add(&part[mat->rows-1-r], &mat->data[r*mat->cols], mat->cols);
+    }
+    else{
+      for(long c=0; c<mat->cols; c++){
+        part[mat->rows-1-r+c] += mget(mat, r, c);
+      }
+    }
+  }
+}
+
+// Sum the diagonals of the binary matrix file path, which may be a
+// shared memory segment from matrix_to_shm(), with nprocs worker
+// processes, at most one per row and no more than PROCS_MAX. Sets
+// *vec_ref to the sums which must later be freed with
+// vector_free_data() and stores the dimensions in *rows_ref and
+// *cols_ref. Returns 0 on success and 1 on error, including any
+// worker failing.
+int sumdiag_PROCS(char *path, int nprocs, vector_t *vec_ref, long *rows_ref, long *cols_ref){
+  matrix_t mat;
+  matrix_map_t map;
+  if(matrix_map_binary(path, &mat, &map, SUMDIAG_MAP_WILLNEED) != 0){
+    return 1;
+  }
+  if(nprocs > PROCS_MAX){
+    nprocs = PROCS_MAX;
+  }
+  if(nprocs > mat.rows){
+    nprocs = mat.rows;
+  }
+  if(nprocs < 1){
+    nprocs = 1;
+  }
+  long len = mat.rows + mat.cols - 1;
+  long stride = sumdiag_pool_stride(len);
+  size_t bytes = sizeof(int) * stride * nprocs;
+  int *partials = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  vector_t vec;
+  if(partials == MAP_FAILED || vector_init(&vec, len) != 0){
+    printf("sumdiag_procs: out of memory\n");
+    if(partials != MAP_FAILED){
+      munmap(partials, bytes);
+    }
+    sumdiag_unmap(&map);
+    return 1;
+  }
+
+  fflush(stdout);                       // children must not repeat buffered output
+  pid_t pids[nprocs];
+  int ret = 0, started = 0;
+  for(; started<nprocs; started++){
+    long r0, r1;
+    sumdiag_pool_share(mat.rows, started, nprocs, &r0, &r1);
+    pids[started] = fork();
+    if(pids[started] < 0){
+      perror("sumdiag_procs: fork failed");
+      ret = 1;
+      break;
+    }
+    if(pids[started] == 0){             // worker: shared zeroed partial, then done
+      procs_band(&mat, partials + started * stride, r0, r1);
+      _exit(0);
+    }
+  }
+  for(int i=0; i<started; i++){
+    int status;
+    pid_t done;
+    do{
+      done = waitpid(pids[i], &status, 0);
+    } while(done < 0 && errno == EINTR);
+    if(done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+      printf("sumdiag_procs: worker %d failed\n",i);
+      ret = 1;
+    }
+  }
+
+  if(!ret){
+    row_add_fn add = sumdiag_row_kernel();
+    memcpy(vec.data, partials, sizeof(int) * len);
+    for(int i=1; i<nprocs; i++){
+      add(vec.data, partials + i * stride, len);
+    }
+  }
+  munmap(partials, bytes);
+  sumdiag_unmap(&map);
+  if(ret){
+    vector_free_data(&vec);
+    return 1;
+  }
+  *vec_ref = vec;
+  *rows_ref = mat.rows;
+  *cols_ref = mat.cols;
+  return 0;
+}
+
+// Create the POSIX shared memory segment name, which starts with a
+// slash, holding mat in binary form and store its path for use with
+// sumdiag_PROCS() or matrix_map_binary() in path, of size path_len.
+// Remove it with shm_unlink(name). Returns 0 on success and 1 on error.
+int matrix_to_shm(char *name, matrix_t mat, char *path, size_t path_len){
+  int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if(fd < 0){
+    perror("couldn't create shared memory segment");
+    return 1;
+  }
+  close(fd);
+  snprintf(path, path_len, "/dev/shm%s", name);
+  if(matrix_write_binary(path, mat, 0) != 0){
+    shm_unlink(name);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+// sumdiag_random.c: parallel random fill matching pb_rand().
+//
+// pb_rand() is the LCG state = state*a + c with a = 1103515245 and
+// c = 12345 on the unsigned long global state in sumdiag_util.c, and
+// matrix_fill_random() draws one value per element in row-major
+// order. Applying the step n times is itself an LCG step,
+// state*A_n + C_n, and A_n, C_n are found in O(log n) by squaring, so
+// matrix_fill_random_threads() jumps each worker straight to the state
+// at the start of its band of rows. Each worker then runs a private
+// copy of the generator so the matrix is bit for bit that of the
+// sequential fill and the global state ends where the sequential fill
+// would leave it.
+//
+// The values use bits 16 to 30 of the state, which depend only on its
+// low 32 bits, so the AVX2 loop runs 8 consecutive states in 32-bit
+// lanes, each advanced 8 steps at a time, and reduces modulo max by a
+// float reciprocal with an exact correction.
+
+#include "sumdiag.h"
+#include <immintrin.h>
+
+#define LCG_MULT 1103515245UL
+#define LCG_INC  12345UL
+
+extern unsigned long state;             // pb_rand() state in sumdiag_util.c
+
+// Set *mult and *inc so that n steps of pb_rand()'s LCG take s to
+// s * *mult + *inc
+static void lcg_jump(unsigned long n, unsigned long *mult, unsigned long *inc){
+  unsigned long m = 1, i = 0;           // accumulated jump
+  unsigned long sm = LCG_MULT, si = LCG_INC;   // jump of 2^k steps
+  for(; n > 0; n >>= 1){
+    if(n & 1){
+      m *= sm;
+      i = i * sm + si;
+    }
+    si = (sm + 1) * si;
+    sm *= sm;
+  }
+  *mult = m;
+  *inc = i;
+}
+
+// State of pb_rand()'s generator n steps after s
+unsigned long pb_skip(unsigned long s, unsigned long n){
+  unsigned long mult, inc;
+  lcg_jump(n, &mult, &inc);
+  return s * mult + inc;
+}
+
+// Fill dst[0..n-1] with the values pb_rand() % max would give starting
+// from state s
+static void fill_scalar(int *dst, long n, unsigned long s, int max){
+  for(long i=0; i<n; i++){
+    s = s * LCG_MULT + LCG_INC;
+    dst[i] = (unsigned int) (s / 65536) % 32768 % max;
+  }
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(int *dst, long n, unsigned long s, int max){
+  if(n < 8){
+    fill_scalar(dst, n, s, max);
+    return;
+  }
+  unsigned int lanes[8];
+  unsigned long ls = s;
+  for(int k=0; k<8; k++){               // states for the first 8 values
+    ls = ls * LCG_MULT + LCG_INC;
+    lanes[k] = ls;
+  }
+  unsigned long mult8, inc8;
+  lcg_jump(8, &mult8, &inc8);
+  __m256i v = _mm256_loadu_si256((const __m256i *) lanes);
+  __m256i vmult = _mm256_set1_epi32((unsigned int) mult8);
+  __m256i vinc = _mm256_set1_epi32((unsigned int) inc8);
+  __m256i vmax = _mm256_set1_epi32(max);
+  __m256i mask = _mm256_set1_epi32(32767);
+  __m256 inv = _mm256_set1_ps(1.0f / max);
+  long i = 0;
+  for(; i+8 <= n; i+=8){
+    __m256i x = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+    // q is within one of x/max as x < 2^15; fix r into [0,max)
+    __m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(x), inv));
+    __m256i r = _mm256_sub_epi32(x, _mm256_mullo_epi32(q, vmax));
+    r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), r), vmax));
+    r = _mm256_sub_epi32(r, _mm256_andnot_si256(_mm256_cmpgt_epi32(vmax, r), vmax));
+    _mm256_storeu_si256((__m256i *) (dst+i), r);
+    v = _mm256_add_epi32(_mm256_mullo_epi32(v, vmult), vinc);
+  }
+  fill_scalar(dst+i, n-i, pb_skip(s, i), max);
+}
+
+typedef struct {
+  matrix_t mat;
+  int max;
+  unsigned long start;          // state before the first element
+  int avx2;
+} fill_job_t;
+
+// Pool task: fill worker id's band of rows from the state jumped to
+// the band's first element
+static void fill_task(void *arg, int id, int nworkers){
+  fill_job_t *job = (fill_job_t *) arg;
+  matrix_t mat = job->mat;
+  long r0, r1;
+  sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+  unsigned long s = pb_skip(job->start, r0 * mat.cols);
+  if(mat.layout == MATRIX_ROW_MAJOR){
+    int *dst = &mat.data[r0 * mat.cols];
+    long n = (r1 - r0) * mat.cols;
+    if(job->avx2){
+      fill_avx2(dst, n, s, job->max);
+    }
+    else{
+      fill_scalar(dst, n, s, job->max);
+    }
+    return;
+  }
+  for(long r=r0; r<r1; r++){
+    for(long c=0; c<mat.cols; c++){
+      fill_scalar(&mat.data[matrix_offset(&mat, r, c)], 1, s, job->max);
+      s = s * LCG_MULT + LCG_INC;
+    }
+  }
+}
+
+// Fill mat with random values from 0 to max-1 using thread_count
+// threads, giving exactly the values and final pb_rand() state of
+// matrix_fill_random(). Returns 0 on success and 1 on error.
+int matrix_fill_random_threads(matrix_t mat, int max, int thread_count){
+  if(max <= 0){
+    printf("matrix_fill_random: max must be positive\n");
+    return 1;
+  }
+  const char *simd = sumdiag_simd_name();
+  fill_job_t job = {mat, max, state};
+  job.avx2 = strcmp(simd, "avx2") == 0 || strcmp(simd, "avx512") == 0;
+  if(sumdiag_pool_run(fill_task, &job, thread_count < 1 ? 1 : thread_count) != 0){
+    printf("matrix_fill_random: couldn't start thread pool\n");
+    return 1;
+  }
+  state = pb_skip(job.start, mat.rows * mat.cols);
+  return 0;
+}
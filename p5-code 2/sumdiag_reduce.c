@@ -0,0 +1,214 @@
+// sumdiag_reduce.c: general per-diagonal reductions.
+//
+// diag_reduce() computes the sum, minimum, maximum, count or mean of
+// each diagonal, optionally over only the elements passing a filter:
+// either x > threshold or a caller supplied predicate. Like
+// sumdiag_ROWS() it sweeps the matrix row by row combining each row
+// into the window of the output starting at rows-1-r, so every op
+// gets the same streaming access pattern. The common case of no filter
+// or a threshold filter has an AVX2 kernel which does the comparison
+// as a mask; predicates are called per element in the scalar kernel.
+// Threads take bands of rows into private partials which are tree
+// reduced with the op, as in sumdiag_OPTM().
+
+#include "sumdiag.h"
+#include "probes.h"
+#include <limits.h>
+#include <immintrin.h>
+
+// Kernel combining n elements of src into dst with op; cnt, used only
+// by DIAG_MEAN, counts the elements which passed the filter.
+typedef void (*combine_fn)(int *dst, int *cnt, const int *src, long n, const diag_op_t *op);
+
+// Does element x pass the filter of op
+static inline int diag_keep(const diag_op_t *op, int x){
+  switch(op->filter){
+    case DIAG_ABOVE: return x > op->threshold;
+    case DIAG_CALL:  return op->pred(x, op->arg);
+    default:         return 1;
+  }
+}
+
+static void combine_scalar(int *dst, int *cnt, const int *src, long n, const diag_op_t *op){
+  for(long i=0; i<n; i++){
+    int x = src[i];
+    if(!diag_keep(op, x)){
+      continue;
+    }
+    switch(op->op){
+      case DIAG_SUM:   dst[i] += x;                       break;
+      case DIAG_MIN:   dst[i] = x < dst[i] ? x : dst[i];  break;
+      case DIAG_MAX:   dst[i] = x > dst[i] ? x : dst[i];  break;
+      case DIAG_COUNT: dst[i] += 1;                       break;
+      case DIAG_MEAN:  dst[i] += x; cnt[i] += 1;          break;
+    }
+  }
+}
+
+// AVX2 version for DIAG_ALL and DIAG_ABOVE: the filter becomes a lane
+// mask of all ones for kept elements which is ANDed or blended in.
+__attribute__((target("avx2")))
+static void combine_avx2(int *dst, int *cnt, const int *src, long n, const diag_op_t *op){
+  if(op->filter == DIAG_CALL){
+    combine_scalar(dst, cnt, src, n, op);
+    return;
+  }
+  __m256i thresh = _mm256_set1_epi32(op->threshold);
+  __m256i ones = _mm256_set1_epi32(-1);
+  __m256i imax = _mm256_set1_epi32(INT_MAX);
+  __m256i imin = _mm256_set1_epi32(INT_MIN);
+  long i = 0;
+  for(; i+8 <= n; i+=8){
+    __m256i x = _mm256_loadu_si256((const __m256i *) (src+i));
+    __m256i d = _mm256_loadu_si256((const __m256i *) (dst+i));
+    __m256i m = op->filter == DIAG_ABOVE ? _mm256_cmpgt_epi32(x, thresh) : ones;
+    switch(op->op){
+      case DIAG_SUM:
+      case DIAG_MEAN:  d = _mm256_add_epi32(d, _mm256_and_si256(x, m));              break;
+      case DIAG_MIN:   d = _mm256_min_epi32(d, _mm256_blendv_epi8(imax, x, m));      break;
+      case DIAG_MAX:   d = _mm256_max_epi32(d, _mm256_blendv_epi8(imin, x, m));      break;
+      case DIAG_COUNT: d = _mm256_sub_epi32(d, m);                                   break;
+    }
+    _mm256_storeu_si256((__m256i *) (dst+i), d);
+    if(op->op == DIAG_MEAN){
+      __m256i c = _mm256_loadu_si256((const __m256i *) (cnt+i));
+      _mm256_storeu_si256((__m256i *) (cnt+i), _mm256_sub_epi32(c, m));
+    }
+  }
+  combine_scalar(dst+i, cnt == NULL ? NULL : cnt+i, src+i, n-i, op);
+}
+
+// Use the AVX2 kernel when the row kernel chosen by sumdiag_simd.c is
+// at least AVX2 so SUMDIAG_SIMD also selects the reduction kernels.
+static combine_fn combine_kernel(){
+  const char *name = sumdiag_simd_name();
+  if(strcmp(name, "avx2") == 0 || strcmp(name, "avx512") == 0){
+    return combine_avx2;
+  }
+  return combine_scalar;
+}
+
+// Starting value of each output for op
+static int diag_identity(int op){
+  switch(op){
+    case DIAG_MIN: return INT_MAX;
+    case DIAG_MAX: return INT_MIN;
+    default:       return 0;
+  }
+}
+
+typedef struct {
+  matrix_t mat;
+  diag_op_t op;
+  vector_t out;
+  int *partials;                // out and count partials, stride apart
+  long stride;                  // worker id's out is at partials[(2*id-1)*stride]
+} reduce_job_t;
+
+// Output and count partials for worker id; worker 0 uses out directly
+static int *reduce_out(reduce_job_t *job, int id){
+  return id == 0 ? job->out.data : job->partials + (2*id-1) * job->stride;
+}
+static int *reduce_cnt(reduce_job_t *job, int id){
+  return job->partials + 2*id * job->stride;
+}
+
+// Tree reduction step: merge the partials of worker src into dst's.
+// Partials merge with plain adds for sums and counts and with the
+// unfiltered op for min and max.
+static void reduce_merge(void *arg, int dst, int src, int end, int nworkers){
+  reduce_job_t *job = (reduce_job_t *) arg;
+  long len = job->out.len;
+  row_add_fn add = sumdiag_row_kernel();
+  if(job->op.op == DIAG_MIN || job->op.op == DIAG_MAX){
+    diag_op_t merge = {job->op.op, DIAG_ALL};
+    combine_kernel()(reduce_out(job, dst), NULL, reduce_out(job, src), len, &merge);
+  }
+  else{
+    add(reduce_out(job, dst), reduce_out(job, src), len);
+  }
+  if(job->op.op == DIAG_MEAN){
+    add(reduce_cnt(job, dst), reduce_cnt(job, src), len);
+  }
+}
+
+// Pool task: combine worker id's band of rows, then tree reduce
+static void reduce_task(void *arg, int id, int nworkers){
+  reduce_job_t *job = (reduce_job_t *) arg;
+  matrix_t mat = job->mat;
+  const diag_op_t *op = &job->op;
+  combine_fn combine = combine_kernel();
+  int mean = op->op == DIAG_MEAN;
+  int *out = reduce_out(job, id);
+  int *cnt = mean ? reduce_cnt(job, id) : NULL;
+  long len = job->out.len;
+
+  long r0, r1;
+  sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+  PROBE5(sumdiag, worker_start, id, r0, r1, mat.rows, mat.cols);
+  int ident = diag_identity(op->op);
+  for(long i=0; i<len; i++){
+    out[i] = ident;
+  }
+  if(mean){
+    memset(cnt, 0, sizeof(int) * len);
+  }
+  for(long r=r0; r<r1; r++){
+    long d = mat.rows-1-r;
+    combine(&out[d], mean ? &cnt[d] : NULL, &mat.data[r*mat.cols], mat.cols, op);
+  }
+
+  sumdiag_pool_tree(id, nworkers, reduce_merge, job);
+  PROBE5(sumdiag, worker_end, id, r0, r1, mat.rows, mat.cols);
+}
+
+// Reduce each diagonal of mat with op using thread_count threads,
+// storing one value per diagonal in out which must have length
+// rows+cols-1. Diagonals are numbered as in sumdiag_BASE(). For
+// DIAG_MIN and DIAG_MAX diagonals with no element passing the filter
+// get INT_MAX and INT_MIN. For DIAG_MEAN out receives the sums and
+// mean, which must have room for rows+cols-1 doubles, the means; NAN
+// for diagonals with no elements passing the filter. mean is ignored
+// for other ops. Returns 0 on success and 1 on error.
+int diag_reduce(matrix_t mat, diag_op_t op, vector_t out, double *mean, int thread_count){
+  if(out.len != (mat.rows + mat.cols - 1)){
+    printf("diag_reduce: bad sizes\n");
+    return 1;
+  }
+  if(mat.layout != MATRIX_ROW_MAJOR){
+    printf("diag_reduce: bad layout\n");
+    return 1;
+  }
+  if(op.op < DIAG_SUM || op.op > DIAG_MEAN ||
+     (op.filter == DIAG_CALL && op.pred == NULL) ||
+     (op.op == DIAG_MEAN && mean == NULL))
+  {
+    printf("diag_reduce: bad operator\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+
+  reduce_job_t job = {mat, op, out};
+  job.stride = sumdiag_pool_stride(out.len);
+  long nparts = 2*thread_count - 1;       // worker 0 needs only a count
+  if(thread_count > 1 || op.op == DIAG_MEAN){
+    job.partials = sumdiag_pool_scratch(sizeof(int) * job.stride * nparts);
+    if(job.partials == NULL){
+      printf("diag_reduce: out of memory\n");
+      return 1;
+    }
+  }
+  if(sumdiag_pool_run(reduce_task, &job, thread_count) != 0){
+    printf("diag_reduce: couldn't start thread pool\n");
+    return 1;
+  }
+  if(op.op == DIAG_MEAN){
+    int *cnt = reduce_cnt(&job, 0);
+    for(long i=0; i<out.len; i++){
+      mean[i] = cnt[i] == 0 ? NAN : (double) out.data[i] / cnt[i];
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,283 @@
+// sumdiag_sparse.c: sparse matrices in compressed sparse row (CSR)
+// form and diagonal sums over their nonzeros.
+//
+// Dense sumdiag touches all rows*cols elements even when nearly all
+// are zero. A sparse_matrix_t keeps only the nonzeros: row r's are at
+// positions row_ptr[r] to row_ptr[r+1]-1 of col_idx[] and vals[].
+// sumdiag_SPARSE() scatters each one into vec[rows-1-r+c] so its time
+// is proportional to the number of nonzeros plus the vector length.
+// Threads take bands of rows holding equal numbers of nonzeros and
+// scatter into private partials which are tree reduced as in
+// sumdiag_OPTM() so no atomics are needed on vec.
+//
+// Matrices are built from CSR arrays, from coordinate (COO) triples,
+// from a dense matrix or read from a file in coordinate form:
+//
+//   rows cols nnz
+//   r c value          <- nnz lines with 0-based row and column
+//   ...
+
+#include "sumdiag.h"
+#include "probes.h"
+
+// Allocate arrays for a sparse matrix of the given size with room for
+// nnz nonzeros. Returns 0 on success and 1 on bad sizes or if out of
+// memory.
+static int sparse_alloc(sparse_matrix_t *smat, long rows, long cols, long nnz){
+  if(rows<=0 || cols<=0 || nnz<0){
+    printf("Invalid sparse size: %ld %ld %ld\n",rows,cols,nnz);
+    return 1;
+  }
+  smat->rows = rows;
+  smat->cols = cols;
+  smat->nnz = nnz;
+  smat->row_ptr = malloc(sizeof(long) * (rows+1));
+  smat->col_idx = malloc(sizeof(long) * (nnz > 0 ? nnz : 1));
+  smat->vals = malloc(sizeof(int) * (nnz > 0 ? nnz : 1));
+  if(smat->row_ptr == NULL || smat->col_idx == NULL || smat->vals == NULL){
+    printf("sparse matrix: out of memory\n");
+    sparse_free_data(smat);
+    return 1;
+  }
+  return 0;
+}
+
+// Frees memory associated with the arrays of smat.
+void sparse_free_data(sparse_matrix_t *smat){
+  free(smat->row_ptr);
+  free(smat->col_idx);
+  free(smat->vals);
+  smat->row_ptr = NULL;
+  smat->col_idx = NULL;
+  smat->vals = NULL;
+  smat->rows = -1;
+  smat->cols = -1;
+  smat->nnz = 0;
+}
+
+// Build smat from CSR arrays which are copied: row_ptr has rows+1
+// entries starting at 0 and col_idx and vals have row_ptr[rows]. Returns
+// 0 on success and 1 on inconsistent arrays or if out of memory.
+int sparse_from_csr(sparse_matrix_t *smat, long rows, long cols,
+                    const long *row_ptr, const long *col_idx, const int *vals){
+  long nnz = row_ptr[rows];
+  for(long r=0; r<rows; r++){
+    if(row_ptr[r] > row_ptr[r+1] || row_ptr[0] != 0){
+      printf("sparse_from_csr: bad row_ptr at row %ld\n",r);
+      return 1;
+    }
+  }
+  for(long i=0; i<nnz; i++){
+    if(col_idx[i] < 0 || col_idx[i] >= cols){
+      printf("sparse_from_csr: bad column %ld\n",col_idx[i]);
+      return 1;
+    }
+  }
+  if(sparse_alloc(smat, rows, cols, nnz)){
+    return 1;
+  }
+  memcpy(smat->row_ptr, row_ptr, sizeof(long) * (rows+1));
+  memcpy(smat->col_idx, col_idx, sizeof(long) * nnz);
+  memcpy(smat->vals, vals, sizeof(int) * nnz);
+  return 0;
+}
+
+// Build smat from nnz coordinate triples (row_idx[i], col_idx[i],
+// vals[i]) in any order. Entries are bucketed by row with a counting
+// sort so building is O(nnz + rows); duplicates are kept and summed
+// along with the rest. Returns 0 on success and 1 on out of range
+// indices or if out of memory.
+int sparse_from_coo(sparse_matrix_t *smat, long rows, long cols, long nnz,
+                    const long *row_idx, const long *col_idx, const int *vals){
+  for(long i=0; i<nnz; i++){
+    if(row_idx[i] < 0 || row_idx[i] >= rows || col_idx[i] < 0 || col_idx[i] >= cols){
+      printf("sparse_from_coo: entry %ld at (%ld,%ld) out of range\n",i,row_idx[i],col_idx[i]);
+      return 1;
+    }
+  }
+  if(sparse_alloc(smat, rows, cols, nnz)){
+    return 1;
+  }
+  memset(smat->row_ptr, 0, sizeof(long) * (rows+1));
+  for(long i=0; i<nnz; i++){            // count per row, shifted by one
+    smat->row_ptr[row_idx[i]+1]++;
+  }
+  for(long r=0; r<rows; r++){           // prefix sum gives row starts
+    smat->row_ptr[r+1] += smat->row_ptr[r];
+  }
+  for(long i=0; i<nnz; i++){            // place using row_ptr as cursors
+    long pos = smat->row_ptr[row_idx[i]]++;
+    smat->col_idx[pos] = col_idx[i];
+    smat->vals[pos] = vals[i];
+  }
+  for(long r=rows; r>0; r--){           // cursors ended at next row start
+    smat->row_ptr[r] = smat->row_ptr[r-1];
+  }
+  smat->row_ptr[0] = 0;
+  return 0;
+}
+
+// Build smat from the nonzeros of a dense matrix in any layout. Returns
+// 0 on success and 1 if out of memory.
+int sparse_from_dense(sparse_matrix_t *smat, matrix_t mat){
+  long nnz = 0;
+  for(long r=0; r<mat.rows; r++){
+    for(long c=0; c<mat.cols; c++){
+      nnz += mget(&mat,r,c) != 0;
+    }
+  }
+  if(sparse_alloc(smat, mat.rows, mat.cols, nnz)){
+    return 1;
+  }
+  long pos = 0;
+  for(long r=0; r<mat.rows; r++){
+    smat->row_ptr[r] = pos;
+    for(long c=0; c<mat.cols; c++){
+      int x = mget(&mat,r,c);
+      if(x != 0){
+        smat->col_idx[pos] = c;
+        smat->vals[pos] = x;
+        pos++;
+      }
+    }
+  }
+  smat->row_ptr[mat.rows] = pos;
+  return 0;
+}
+
+// Read a matrix in coordinate form from the named file; see the top of
+// this file for the format. Returns 0 on success and 1 on errors which
+// are reported on stdout.
+int sparse_read_from_file(char *fname, sparse_matrix_t *smat){
+  FILE *file = fopen(fname,"r");
+  if(file == NULL){
+    perror("couldn't open sparse matrix file");
+    return 1;
+  }
+  long rows, cols, nnz;
+  if(fscanf(file, "%ld %ld %ld", &rows, &cols, &nnz) != 3 || nnz < 0){
+    printf("%s: bad sparse matrix header\n",fname);
+    fclose(file);
+    return 1;
+  }
+  long *row_idx = malloc(sizeof(long) * (nnz > 0 ? nnz : 1));
+  long *col_idx = malloc(sizeof(long) * (nnz > 0 ? nnz : 1));
+  int *vals = malloc(sizeof(int) * (nnz > 0 ? nnz : 1));
+  int ret = row_idx == NULL || col_idx == NULL || vals == NULL;
+  for(long i=0; !ret && i<nnz; i++){
+    if(fscanf(file, "%ld %ld %d", &row_idx[i], &col_idx[i], &vals[i]) != 3){
+      printf("%s: bad entry %ld\n",fname,i);
+      ret = 1;
+    }
+  }
+  fclose(file);
+  if(!ret){
+    ret = sparse_from_coo(smat, rows, cols, nnz, row_idx, col_idx, vals);
+  }
+  free(row_idx);
+  free(col_idx);
+  free(vals);
+  return ret;
+}
+
+typedef struct {
+  sparse_matrix_t mat;
+  vector_t vec;
+  int *partials;                // partial vectors of workers 1 and up
+  long stride;                  // ints from one partial to the next
+} sparse_job_t;
+
+// First row of worker id's band: bands are split at the rows where
+// the running nonzero count crosses multiples of nnz/nworkers
+static long sparse_band_start(sparse_matrix_t *mat, int id, int nworkers){
+  if(id >= nworkers){
+    return mat->rows;
+  }
+  long target = mat->nnz * id / nworkers;
+  long lo = 0, hi = mat->rows;          // first row with row_ptr >= target
+  while(lo < hi){
+    long mid = (lo + hi) / 2;
+    if(mat->row_ptr[mid] < target){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return id == 0 ? 0 : lo;
+}
+
+// Set [*lo,*hi) to the part of vec that rows r0 to r1-1 scatter into
+static void sparse_window(sparse_matrix_t *mat, long r0, long r1, long *lo, long *hi){
+  *lo = mat->rows - r1;
+  *hi = r1 > r0 ? mat->rows - 1 - r0 + mat->cols : *lo;
+}
+
+// Tree reduction step: add partial src, holding the bands of workers
+// src to end-1, into partial dst over the window those bands cover
+static void sparse_merge(void *arg, int dst, int src, int end, int nworkers){
+  sparse_job_t *job = (sparse_job_t *) arg;
+  long lo, hi;
+  sparse_window(&job->mat, sparse_band_start(&job->mat, src, nworkers),
+                sparse_band_start(&job->mat, end, nworkers), &lo, &hi);
+  int *to = dst == 0 ? job->vec.data : job->partials + (dst-1) * job->stride;
+  sumdiag_row_kernel()(&to[lo], job->partials + (src-1) * job->stride + lo, hi - lo);
+}
+
+// Pool task: scatter worker id's band into its partial, zeroed only
+// over the window of the bands it absorbs, then tree reduce
+static void sparse_task(void *arg, int id, int nworkers){
+  sparse_job_t *job = (sparse_job_t *) arg;
+  sparse_matrix_t mat = job->mat;
+  int *part = id == 0 ? job->vec.data : job->partials + (id-1) * job->stride;
+
+  long r0 = sparse_band_start(&mat, id, nworkers);
+  long r1 = sparse_band_start(&mat, id+1, nworkers);
+  PROBE5(sumdiag, worker_start, id, r0, r1, mat.rows, mat.cols);
+  long lo, hi;
+  if(id == 0){
+    lo = 0;
+    hi = job->vec.len;
+  }
+  else{
+    int span = id & -id;                // bands absorbed in the reduction
+    sparse_window(&mat, r0, sparse_band_start(&mat, id+span, nworkers), &lo, &hi);
+  }
+  memset(part + lo, 0, sizeof(int) * (hi - lo));
+  for(long r=r0; r<r1; r++){
+    int *dst = &part[mat.rows-1-r];
+    for(long k=mat.row_ptr[r]; k<mat.row_ptr[r+1]; k++){
+      dst[mat.col_idx[k]] += mat.vals[k];
+    }
+  }
+
+  sumdiag_pool_tree(id, nworkers, sparse_merge, job);
+  PROBE5(sumdiag, worker_end, id, r0, r1, mat.rows, mat.cols);
+}
+
+// Diagonal sums of a sparse matrix into vec, which must have length
+// rows+cols-1, with thread_count threads. Returns 0 on success and 1
+// on error.
+int sumdiag_SPARSE(sparse_matrix_t mat, vector_t vec, int thread_count){
+  if(vec.len != (mat.rows + mat.cols - 1)){
+    printf("sumdiag_sparse: bad sizes\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  sparse_job_t job = {mat, vec};
+  job.stride = sumdiag_pool_stride(vec.len);
+  if(thread_count > 1){
+    job.partials = sumdiag_pool_scratch(sizeof(int) * job.stride * (thread_count-1));
+    if(job.partials == NULL){
+      printf("sumdiag_sparse: out of memory\n");
+      return 1;
+    }
+  }
+  if(sumdiag_pool_run(sparse_task, &job, thread_count) != 0){
+    printf("sumdiag_sparse: couldn't start thread pool\n");
+    return 1;
+  }
+  return 0;
+}
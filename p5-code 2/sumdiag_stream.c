@@ -0,0 +1,142 @@
+// sumdiag_stream.c: diagonal sums of a matrix streamed from a file
+// without holding the whole matrix in memory.
+//
+// Row r of a matrix adds into the window of the output starting at
+// rows-1-r so the rows can be summed as they arrive and dropped. The
+// matrix, in the text format of matrix_read_from_file(), is read in
+// chunks of rows into two buffers: a reader thread parses the next
+// chunk into one while the calling thread adds the rows of the other
+// into the output with the SIMD row kernel, so I/O overlaps with the
+// sums. Only the two buffers and the output vector are allocated, the
+// buffers together fitting in a caller given byte budget, and the file
+// is read strictly forward so stdin and pipes work.
+
+#include "sumdiag.h"
+
+typedef struct {
+  FILE *file;
+  long rows;
+  long cols;
+  long chunk_rows;              // rows per buffer
+  int *buf[2];
+  long filled[2];               // rows parsed into each buffer
+  int ready[2];                 // buffer holds rows not yet summed
+  int error;                    // reader hit bad input
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} stream_t;
+
+// Reader thread: parse successive chunks into alternating buffers,
+// waiting for the summing thread to release each before refilling it
+static void *stream_reader(void *arg){
+  stream_t *st = (stream_t *) arg;
+  long row = 0;
+  for(long k=0; row < st->rows; k++){
+    int b = k % 2;
+    pthread_mutex_lock(&st->lock);
+    while(st->ready[b]){
+      pthread_cond_wait(&st->cond, &st->lock);
+    }
+    pthread_mutex_unlock(&st->lock);
+
+    long n = st->rows - row < st->chunk_rows ? st->rows - row : st->chunk_rows;
+    int error = 0;
+    for(long i=0; i<n*st->cols; i++){
+      if(fscanf(st->file, "%d", &st->buf[b][i]) != 1){
+        printf("sumdiag_stream: bad or missing element at row %ld\n", row + i / st->cols);
+        error = 1;
+        break;
+      }
+    }
+
+    pthread_mutex_lock(&st->lock);
+    st->filled[b] = n;
+    st->ready[b] = 1;
+    st->error = error;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+    if(error){
+      break;
+    }
+    row += n;
+  }
+  return NULL;
+}
+
+// Read a matrix in the format of matrix_read_from_file() from file,
+// which may be a pipe, and set *vec_ref to its diagonal sums which
+// must later be freed with vector_free_data(). The row buffers use at
+// most budget bytes, or a single row each if one row exceeds half the
+// budget. The dimensions are stored in *rows_ref and *cols_ref. Returns
+// 0 on success and 1 on malformed input or if out of memory.
+int sumdiag_STREAM(FILE *file, long budget, vector_t *vec_ref, long *rows_ref, long *cols_ref){
+  long rows, cols;
+  if(fscanf(file, "%ld %ld", &rows, &cols) != 2 || rows <= 0 || cols <= 0){
+    printf("sumdiag_stream: bad matrix header\n");
+    return 1;
+  }
+  stream_t st = {file, rows, cols};
+  st.chunk_rows = budget / 2 / (long) sizeof(int) / cols;
+  if(st.chunk_rows < 1){
+    st.chunk_rows = 1;
+  }
+  if(st.chunk_rows > rows){
+    st.chunk_rows = rows;
+  }
+  vector_t vec;
+  st.buf[0] = malloc(sizeof(int) * st.chunk_rows * cols);
+  st.buf[1] = malloc(sizeof(int) * st.chunk_rows * cols);
+  if(st.buf[0] == NULL || st.buf[1] == NULL || vector_init(&vec, rows+cols-1) != 0){
+    printf("sumdiag_stream: out of memory\n");
+    free(st.buf[0]);
+    free(st.buf[1]);
+    return 1;
+  }
+  memset(vec.data, 0, sizeof(int) * vec.len);
+  pthread_mutex_init(&st.lock, NULL);
+  pthread_cond_init(&st.cond, NULL);
+
+  pthread_t reader;
+  int started = pthread_create(&reader, NULL, stream_reader, &st) == 0;
+  int ret = !started;
+  if(ret){
+    printf("sumdiag_stream: couldn't start reader thread\n");
+  }
+  row_add_fn add = sumdiag_row_kernel();
+  long row = 0;
+  for(long k=0; !ret && row < rows; k++){
+    int b = k % 2;
+    pthread_mutex_lock(&st.lock);
+    while(!st.ready[b]){
+      pthread_cond_wait(&st.cond, &st.lock);
+    }
+    ret = st.error;
+    pthread_mutex_unlock(&st.lock);
+    if(ret){
+      break;
+    }
+    for(long i=0; i<st.filled[b]; i++, row++){
+      add(&vec.data[rows-1-row], &st.buf[b][i*cols], cols);
+    }
+    pthread_mutex_lock(&st.lock);
+    st.ready[b] = 0;
+    pthread_cond_broadcast(&st.cond);
+    pthread_mutex_unlock(&st.lock);
+  }
+  if(started){                          // reader is done or stopped at an error
+    pthread_join(reader, NULL);
+  }
+
+  pthread_mutex_destroy(&st.lock);
+  pthread_cond_destroy(&st.cond);
+  free(st.buf[0]);
+  free(st.buf[1]);
+  if(ret){
+    vector_free_data(&vec);
+    return 1;
+  }
+  *vec_ref = vec;
+  *rows_ref = rows;
+  *cols_ref = cols;
+  return 0;
+}
@@ -0,0 +1,120 @@
+// sumdiag_tracked.c: matrices whose diagonal sums are kept up to date
+// as elements change.
+//
+// Changing a few elements and calling sumdiag again costs a pass over
+// the whole matrix. A tracked_matrix_t holds a matrix along with its
+// diagonal sums, computed once by tracked_init(), and every change made
+// through it adjusts the one affected sum: tracked_set() is O(1) and
+// tracked_add_batch() applies many (row, col, delta) updates at once.
+// The sums are then always current so queries never recompute.
+//
+// A large batch is counting sorted by diagonal so each diagonal's
+// deltas lie in one run which the SIMD horizontal-sum kernel of
+// sumdiag_simd.c reduces to a single add into the sums. Small batches
+// are cheaper to add one at a time.
+
+#include "sumdiag.h"
+
+// Batches with fewer updates than the number of diagonals divided by
+// this are applied directly rather than sorted
+#define TRACKED_SORT_RATIO 4
+
+// Diagonal of element (r,c) as numbered by sumdiag_BASE()
+static long tracked_diag(tracked_matrix_t *tm, long r, long c){
+  return tm->mat.rows-1-r+c;
+}
+
+// Initialize tm with a copy of mat, in the same layout, and its
+// diagonal sums computed with thread_count threads. Returns 0 on
+// success and 1 on error.
+int tracked_init(tracked_matrix_t *tm, matrix_t mat, int thread_count){
+  long n = matrix_data_len(mat.rows, mat.cols, mat.layout);
+  tm->mat = mat;
+  tm->mat.data = malloc(sizeof(int) * n);
+  if(tm->mat.data == NULL || vector_init(&tm->sums, mat.rows+mat.cols-1) != 0){
+    printf("tracked_init: out of memory\n");
+    free(tm->mat.data);
+    return 1;
+  }
+  memcpy(tm->mat.data, mat.data, sizeof(int) * n);
+  if(sumdiag_OPTM(tm->mat, tm->sums, thread_count) != 0){
+    tracked_free_data(tm);
+    return 1;
+  }
+  return 0;
+}
+
+// Frees memory associated with tm.
+void tracked_free_data(tracked_matrix_t *tm){
+  matrix_free_data(&tm->mat);
+  vector_free_data(&tm->sums);
+}
+
+// Element (r,c) of the tracked matrix
+int tracked_get(tracked_matrix_t *tm, long r, long c){
+  return tm->mat.data[matrix_offset(&tm->mat, r, c)];
+}
+
+// Set element (r,c) to x, adjusting its diagonal's sum by the change
+void tracked_set(tracked_matrix_t *tm, long r, long c, int x){
+  int *elem = &tm->mat.data[matrix_offset(&tm->mat, r, c)];
+  tm->sums.data[tracked_diag(tm, r, c)] += x - *elem;
+  *elem = x;
+}
+
+// Add the delta of each of the n updates to its element. Updates may
+// repeat elements and come in any order. Returns 0 on success and 1 if
+// an update is out of range, in which case nothing is changed, or if
+// out of memory.
+int tracked_add_batch(tracked_matrix_t *tm, const cell_update_t *updates, long n){
+  matrix_t mat = tm->mat;
+  for(long i=0; i<n; i++){
+    if(updates[i].row < 0 || updates[i].row >= mat.rows ||
+       updates[i].col < 0 || updates[i].col >= mat.cols)
+    {
+      printf("tracked_add_batch: update %ld at (%ld,%ld) out of range\n",
+             i, updates[i].row, updates[i].col);
+      return 1;
+    }
+  }
+  for(long i=0; i<n; i++){
+    mat.data[matrix_offset(&mat, updates[i].row, updates[i].col)] += updates[i].delta;
+  }
+
+  long len = tm->sums.len;
+  if(n < len / TRACKED_SORT_RATIO){
+    for(long i=0; i<n; i++){
+      tm->sums.data[tracked_diag(tm, updates[i].row, updates[i].col)] += updates[i].delta;
+    }
+    return 0;
+  }
+
+  long *start = calloc(len+1, sizeof(long));
+  int *deltas = malloc(sizeof(int) * (n > 0 ? n : 1));
+  if(start == NULL || deltas == NULL){
+    printf("tracked_add_batch: out of memory\n");
+    free(start);
+    free(deltas);
+    return 1;
+  }
+  for(long i=0; i<n; i++){              // count per diagonal, shifted by one
+    start[tracked_diag(tm, updates[i].row, updates[i].col)+1]++;
+  }
+  for(long d=0; d<len; d++){            // prefix sum gives run starts
+    start[d+1] += start[d];
+  }
+  for(long i=0; i<n; i++){              // place using start as cursors
+    deltas[start[tracked_diag(tm, updates[i].row, updates[i].col)]++] = updates[i].delta;
+  }
+  row_sum_fn sum = sumdiag_row_sum_kernel();
+  long beg = 0;                         // cursors ended at the next run's start
+  for(long d=0; d<len; d++){
+    if(start[d] > beg){
+      tm->sums.data[d] += sum(&deltas[beg], start[d] - beg);
+    }
+    beg = start[d];
+  }
+  free(start);
+  free(deltas);
+  return 0;
+}
@@ -0,0 +1,79 @@
+// sumdiag_typed.c: matrices, vectors and diagonal sums for element
+// types other than int. Each type is generated from the template in
+// sumdiag_typed_impl.h; see SUMDIAG_TYPES in sumdiag.h for the list.
+// Integer types sum into int64_t and floating types into double with
+// Kahan summation.
+
+#include "sumdiag.h"
+
+#define NAME i8
+#define T int8_t
+#define ACC int64_t
+#define ACCNAME i64
+#define KAHAN 0
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
+
+#define NAME i16
+#define T int16_t
+#define ACC int64_t
+#define ACCNAME i64
+#define KAHAN 0
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
+
+#define NAME i32
+#define T int32_t
+#define ACC int64_t
+#define ACCNAME i64
+#define KAHAN 0
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
+
+#define NAME i64
+#define T int64_t
+#define ACC int64_t
+#define ACCNAME i64
+#define KAHAN 0
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
+
+#define NAME f32
+#define T float
+#define ACC double
+#define ACCNAME f64
+#define KAHAN 1
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
+
+#define NAME f64
+#define T double
+#define ACC double
+#define ACCNAME f64
+#define KAHAN 1
+#include "sumdiag_typed_impl.h"
+#undef NAME
+#undef T
+#undef ACC
+#undef ACCNAME
+#undef KAHAN
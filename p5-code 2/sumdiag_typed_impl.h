@@ -0,0 +1,214 @@
+// sumdiag_typed_impl.h: template for the element typed matrices and
+// diagonal sums in sumdiag_typed.c which includes it once per type
+// after defining
+//
+//   NAME     suffix of the type names, e.g. i8 for matrix_i8_t
+//   T        element type
+//   ACC      accumulator type, int64_t or double
+//   ACCNAME  suffix of the vector type holding results, i64 or f64
+//   KAHAN    1 to use compensated summation
+//
+// There is no include guard as the file is meant to be included
+// repeatedly.
+
+#define CAT_(a,b)    a##_##b
+#define CAT(a,b)     CAT_(a,b)
+#define TYPED(x)     CAT(x, NAME)                       // e.g. sumdiag_i8
+#define MATRIX_T     CAT(CAT(matrix, NAME), t)          // matrix_i8_t
+#define VECTOR_T     CAT(CAT(vector, NAME), t)          // vector_i8_t
+#define RESULT_T     CAT(CAT(vector, ACCNAME), t)       // vector_i64_t
+#define LANES        4                                  // ACC per SIMD vector
+
+// GCC vector types: LANES accumulators in one 256-bit register and the
+// LANES elements which widen into them. The _u versions may be
+// unaligned and alias anything so they can be used to load and store.
+typedef ACC TYPED(accv)   __attribute__((vector_size(LANES*sizeof(ACC))));
+typedef ACC TYPED(accv_u) __attribute__((vector_size(LANES*sizeof(ACC)), aligned(1), may_alias));
+typedef T   TYPED(srcv_u) __attribute__((vector_size(LANES*sizeof(T)), aligned(1), may_alias));
+
+int CAT(TYPED(matrix), init)(MATRIX_T *mat, long rows, long cols){
+  if(rows<=0 || cols<=0){
+    printf("Invalid rows or cols: %ld %ld\n",rows,cols);
+    return 1;
+  }
+  mat->data = malloc(sizeof(T) * rows * cols);
+  mat->rows = rows;
+  mat->cols = cols;
+  return 0;
+}
+
+void CAT(TYPED(matrix), free_data)(MATRIX_T *mat){
+  free(mat->data);
+  mat->rows = -1;
+  mat->cols = -1;
+}
+
+int CAT(TYPED(vector), init)(VECTOR_T *vec, long len){
+  if(len<=0){
+    printf("Invalid length: %ld\n",len);
+    return 1;
+  }
+  vec->data = malloc(sizeof(T) * len);
+  vec->len = len;
+  return 0;
+}
+
+void CAT(TYPED(vector), free_data)(VECTOR_T *vec){
+  free(vec->data);
+  vec->len = -1;
+}
+
+// Set the elements of mat to those of src, converted to T, which must
+// be the same size. src may be in any layout; mat is row major.
+void CAT(TYPED(matrix), from_int)(MATRIX_T mat, matrix_t src){
+  if(src.layout != MATRIX_ROW_MAJOR){
+    for(long r=0; r<mat.rows; r++){
+      for(long c=0; c<mat.cols; c++){
+        mat.data[r*mat.cols + c] = (T) mget(&src, r, c);
+      }
+    }
+    return;
+  }
+  for(long i=0; i<mat.rows*mat.cols; i++){
+    mat.data[i] = (T) src.data[i];
+  }
+}
+
+// dst[i] += src[i] for n elements widening each to ACC. With KAHAN
+// comp[i] holds the compensation for dst[i]. The body is a macro so
+// the same code is compiled once for AVX2 and once for the baseline.
+#define ROW_ADD_BODY                                                    \
+  long i = 0;                                                           \
+  for(; i+LANES <= n; i+=LANES){                                        \
+    TYPED(accv) x = __builtin_convertvector(*(TYPED(srcv_u) *) (src+i), TYPED(accv)); \
+    TYPED(accv) s = *(TYPED(accv_u) *) (dst+i);                         \
+    if(KAHAN){                                                          \
+      TYPED(accv) c = *(TYPED(accv_u) *) (comp+i);                      \
+      TYPED(accv) y = x - c;                                            \
+      TYPED(accv) t = s + y;                                            \
+      *(TYPED(accv_u) *) (comp+i) = (t - s) - y;                        \
+      s = t;                                                            \
+    }                                                                   \
+    else{                                                               \
+      s += x;                                                           \
+    }                                                                   \
+    *(TYPED(accv_u) *) (dst+i) = s;                                     \
+  }                                                                     \
+  for(; i<n; i++){                                                      \
+    if(KAHAN){                                                          \
+      ACC y = (ACC) src[i] - comp[i];                                   \
+      ACC t = dst[i] + y;                                               \
+      comp[i] = (t - dst[i]) - y;                                       \
+      dst[i] = t;                                                       \
+    }                                                                   \
+    else{                                                               \
+      dst[i] += (ACC) src[i];                                           \
+    }                                                                   \
+  }
+
+static void TYPED(row_add)(ACC *dst, ACC *comp, const T *src, long n){
+  ROW_ADD_BODY
+}
+
+__attribute__((target("avx2")))
+static void TYPED(row_add_avx2)(ACC *dst, ACC *comp, const T *src, long n){
+  ROW_ADD_BODY
+}
+
+#undef ROW_ADD_BODY
+
+typedef struct {
+  MATRIX_T mat;
+  RESULT_T vec;
+  ACC *scratch;                 // comps of all workers then sums of workers 1 and up
+  long stride;                  // ACCs from one partial to the next
+  int avx2;                     // use the AVX2 kernel
+} TYPED(job_t);
+
+// Merge callback for sumdiag_pool_tree(): add worker src's partial
+// into worker dst's. With KAHAN the sum and then the negated
+// compensation of src are added with compensation.
+static void TYPED(sum_merge)(void *arg, int dst, int src, int end, int nworkers){
+  TYPED(job_t) *job = (TYPED(job_t) *) arg;
+  long len = job->vec.len;
+  ACC *sums = dst == 0 ? job->vec.data : job->scratch + (nworkers + dst - 1) * job->stride;
+  ACC *comp = job->scratch + dst * job->stride;
+  ACC *osums = job->scratch + (nworkers + src - 1) * job->stride;
+  ACC *ocomp = job->scratch + src * job->stride;
+  for(long i=0; i<len; i++){
+    if(KAHAN){
+      ACC parts[2] = {osums[i], -ocomp[i]};
+      for(int k=0; k<2; k++){
+        ACC y = parts[k] - comp[i];
+        ACC t = sums[i] + y;
+        comp[i] = (t - sums[i]) - y;
+        sums[i] = t;
+      }
+    }
+    else{
+      sums[i] += osums[i];
+    }
+  }
+}
+
+// Pool task: widen and add worker id's band of rows into its partial
+// then tree reduce with TYPED(sum_merge)
+static void TYPED(sum_task)(void *arg, int id, int nworkers){
+  TYPED(job_t) *job = (TYPED(job_t) *) arg;
+  MATRIX_T mat = job->mat;
+  long len = job->vec.len;
+  ACC *sums = id == 0 ? job->vec.data : job->scratch + (nworkers + id - 1) * job->stride;
+  ACC *comp = job->scratch + id * job->stride;
+  memset(sums, 0, sizeof(ACC) * len);
+  memset(comp, 0, sizeof(ACC) * len);
+
+  long r0, r1;
+  sumdiag_pool_share(mat.rows, id, nworkers, &r0, &r1);
+  for(long r=r0; r<r1; r++){
+    ACC *dst = &sums[mat.rows-1-r];
+    const T *src = &mat.data[r*mat.cols];
+    if(job->avx2){
+      TYPED(row_add_avx2)(dst, &comp[mat.rows-1-r], src, mat.cols);
+    }
+    else{
+      TYPED(row_add)(dst, &comp[mat.rows-1-r], src, mat.cols);
+    }
+  }
+  sumdiag_pool_tree(id, nworkers, TYPED(sum_merge), job);
+}
+
+// Sum the diagonals of mat into vec, which must have length
+// rows+cols-1, with thread_count threads. Elements are widened to the
+// accumulator type so integer sums can't overflow int and floating
+// point sums use Kahan summation. Returns 0 on success and 1 on error.
+int TYPED(sumdiag)(MATRIX_T mat, RESULT_T vec, int thread_count){
+  if(vec.len != (mat.rows + mat.cols - 1)){
+    printf("sumdiag_typed: bad sizes\n");
+    return 1;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  const char *simd = sumdiag_simd_name();
+  TYPED(job_t) job = {mat, vec};
+  job.stride = sumdiag_pool_stride_of(vec.len, sizeof(ACC));
+  job.avx2 = strcmp(simd, "avx2") == 0 || strcmp(simd, "avx512") == 0;
+  job.scratch = sumdiag_pool_scratch(sizeof(ACC) * job.stride * (2*thread_count - 1));
+  if(job.scratch == NULL){
+    printf("sumdiag_typed: out of memory\n");
+    return 1;
+  }
+  if(sumdiag_pool_run(TYPED(sum_task), &job, thread_count) != 0){
+    printf("sumdiag_typed: couldn't start thread pool\n");
+    return 1;
+  }
+  return 0;
+}
+
+#undef CAT_
+#undef CAT
+#undef TYPED
+#undef MATRIX_T
+#undef VECTOR_T
+#undef RESULT_T
+#undef LANES
@@ -26,6 +26,7 @@ int matrix_init(matrix_t *mat, long rows, long cols){
   mat->data = malloc(sizeof(int) * rows * cols);
   mat->rows = rows;
   mat->cols = cols;
+  mat->layout = MATRIX_ROW_MAJOR;
   return 0;
 }
 
@@ -47,27 +48,16 @@ void matrix_free_data(matrix_t *mat){
 // format of the file is space separated numbers.
 // - first long indicates size of vector
 // - remaining ints are data in the vector
-// Returns 0 on success and non-zero on error.
+// The numbers are parsed in parallel by sumdiag_parse_file(). Returns
+// 0 on success and non-zero on error.
 int vector_read_from_file(char *fname, vector_t *vec_ref){
-  FILE *file = fopen(fname,"r");
-  if(file == NULL){
-    perror("couldn't open vector file");
-    return 1;
-  }
   long len;
-  assert(fscanf(file, "%ld",&len)==1);
-  vector_t vec;
-  int ret = vector_init(&vec,len);
-  if(ret){
-    return ret;
-  }
-  for(int i=0; i<len; i++){
-    int x;
-    assert(fscanf(file,"%d",&x)==1);
-    VSET(vec,i,x);
+  int *data;
+  if(sumdiag_parse_file(fname, 1, &len, &data) != 0){
+    return 1;
   }
-  fclose(file);
-  *vec_ref = vec;
+  vec_ref->len = len;
+  vec_ref->data = data;
   return 0;
 }
 
@@ -76,36 +66,35 @@ int vector_read_from_file(char *fname, vector_t *vec_ref){
 // format of the file is space separated numbers.
 // - first two longs indicate size of matrix
 // - remaining ints are data in the matrix
-// Returns 0 on success and non-zero on error.
+// The numbers are parsed in parallel by sumdiag_parse_file(). Returns
+// 0 on success and non-zero on error.
 int matrix_read_from_file(char *fname, matrix_t *mat_ref){
-  FILE *file = fopen(fname,"r");
-  if(file == NULL){
-    perror("couldn't open matrix file");
+  long dims[2];
+  int *data;
+  if(sumdiag_parse_file(fname, 2, dims, &data) != 0){
     return 1;
   }
-  long rows, cols;
-  assert(fscanf(file, "%ld %ld",&rows,&cols) == 2);
-  matrix_t mat;
-  int ret = matrix_init(&mat,rows,cols);
-  if(ret){
-    return ret;
-  }
-  for(int i=0; i<rows; i++){
-    for(int j=0; j<cols; j++){
-      int x;
-      assert(fscanf(file,"%d",&x)==1);
-      MSET(mat,i,j,x);
-    }
-  }
-  fclose(file);
-  *mat_ref = mat;
+  mat_ref->rows = dims[0];
+  mat_ref->cols = dims[1];
+  mat_ref->data = data;
+  mat_ref->layout = MATRIX_ROW_MAJOR;
   return 0;
 }
 
 // Writes a vector to an open file handle. Prints some dimension
 // information followed by index and data on each line. Use with
-// stdout to print to the screen.
+// stdout to print to the screen. Formatting is buffered; see
+// sumdiag_write.c. If its buffer can't be allocated the vector is
+// printed with fprintf() instead; a failed write is reported on stderr
+// and not retried as part of the vector may already be out.
 void vector_write(FILE *file, vector_t vec){
+  int ret = vector_write_buffered(file, vec);
+  if(ret == SUMDIAG_WRITE_FAILED){
+    fprintf(stderr,"vector_write: write failed\n");
+  }
+  if(ret != SUMDIAG_WRITE_NOMEM){
+    return;
+  }
   fprintf(file,"%ld x 1 vector\n",vec.len);
   for(int i=0; i<vec.len; i++){
     fprintf(file,"%4d: ",i);
@@ -116,13 +105,24 @@ void vector_write(FILE *file, vector_t vec){
 
 // Writes a matrix to an open file handle. Prints some dimension
 // information followed by index and data on each line. Use with
-// stdout to print to the screen.
+// stdout to print to the screen. Formatting is buffered; use
+// matrix_write_threads() to format with several threads. If its
+// buffers can't be allocated the matrix is printed with fprintf()
+// instead; a failed write is reported on stderr and not retried as
+// part of the matrix may already be out.
 void matrix_write(FILE *file, matrix_t mat){
+  int ret = matrix_write_threads(file, mat, 1);
+  if(ret == SUMDIAG_WRITE_FAILED){
+    fprintf(stderr,"matrix_write: write failed\n");
+  }
+  if(ret != SUMDIAG_WRITE_NOMEM){
+    return;
+  }
   fprintf(file,"%ld x %ld matrix\n",mat.rows,mat.cols);
   for(int i=0; i<mat.rows; i++){
     fprintf(file,"%4d: ",i);
     for(int j=0; j<mat.cols; j++){
-      fprintf(file,"%6d ", MGET(mat,i,j));
+      fprintf(file,"%6d ", mget(&mat,i,j));
     }
     fprintf(file,"\n");
   }
@@ -137,12 +137,13 @@ void vector_fill_sequential(vector_t vec){
   }
 }
 
-// Set elements of the given matrix to 0,1,2,...,len. 
+// Set elements of the given matrix to 0,1,2,...,len in row major
+// order whatever its layout.
 void matrix_fill_sequential(matrix_t mat){
   int c = 0;
   for(int i=0; i<mat.rows; i++){
     for(int j=0; j<mat.cols; j++){
-      MSET(mat,i,j,c);
+      mset(&mat,i,j,c);
       c++;
     }
   }
@@ -150,11 +151,11 @@ void matrix_fill_sequential(matrix_t mat){
 
 // getter + setters for vectors and matrices
 int mget(matrix_t *mat, int i, int j){
-  return mat->data[i*mat->cols + j];
+  return mat->data[matrix_offset(mat,i,j)];
 }
 
 void mset(matrix_t *mat, int i, int j, int x){
-  mat->data[i*mat->cols + j] = x;
+  mat->data[matrix_offset(mat,i,j)] = x;
 }
 
 int vget(vector_t *vec, int i){
@@ -184,10 +185,9 @@ void vector_fill_random(vector_t vec, int max){
   }
 }
 
-void matrix_fill_random(matrix_t mat, int max){
-  for(int i=0; i<mat.rows; i++){
-    for(int j=0; j<mat.cols; j++){
-      MSET(mat,i,j,pb_rand() % max);
-    }
-  }
+// Fill mat with pb_rand() % max in row-major order; see
+// matrix_fill_random_threads() in sumdiag_random.c which does the work.
+// Returns 0 on success and 1 on error, e.g. max not positive.
+int matrix_fill_random(matrix_t mat, int max){
+  return matrix_fill_random_threads(mat, max, 1);
 }
@@ -0,0 +1,213 @@
+// sumdiag_write.c: buffered output for matrix_write() and
+// vector_write().
+//
+// One fprintf() per element spends nearly all the time of printing a
+// large matrix in stdio's format parsing. Here integers are formatted
+// by hand two digits at a time from a table of the 100 digit pairs into
+// a large buffer which goes out in a few big write() calls on the
+// file's descriptor; the FILE is flushed first so output already
+// buffered in it stays in order. matrix_write_threads() formats bands
+// of rows on pool workers, each into its own buffer, and writes the
+// buffers in row order. The text is exactly what the printf formats
+// "%4d: " then "%6d " per element would produce.
+
+#include "sumdiag.h"
+#include <errno.h>
+#include <unistd.h>
+
+// Bytes of formatted text each worker produces per round
+#define WRITE_CHUNK (1 << 20)
+
+// Most threads formatting at once; each holds a WRITE_CHUNK buffer
+#define WRITE_MAX_THREADS 64
+
+// Longest text of one int, "-2147483648"
+#define INT_CHARS 11
+
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Format x right justified in width columns at dst as "%*d" would.
+// Returns the number of bytes written.
+static int format_int(char *dst, int x, int width){
+  char tmp[INT_CHARS];
+  char *p = tmp + INT_CHARS;            // digits are built from the end
+  unsigned int u = x < 0 ? 0u - (unsigned int) x : (unsigned int) x;
+  while(u >= 100){
+    unsigned int pair = (u % 100) * 2;
+    u /= 100;
+    *--p = digit_pairs[pair+1];
+    *--p = digit_pairs[pair];
+  }
+  if(u >= 10){
+    *--p = digit_pairs[u*2+1];
+    *--p = digit_pairs[u*2];
+  }
+  else{
+    *--p = '0' + u;
+  }
+  if(x < 0){
+    *--p = '-';
+  }
+  int len = tmp + INT_CHARS - p;
+  int pad = width > len ? width - len : 0;
+  memset(dst, ' ', pad);
+  memcpy(dst + pad, p, len);
+  return pad + len;
+}
+
+// Write n bytes to file, going straight to its descriptor when it has
+// one. Returns 0 on success and SUMDIAG_WRITE_FAILED on error.
+static int write_out(FILE *file, const char *buf, long n){
+  int fd = fileno(file);
+  if(fd < 0){                           // e.g. memory streams
+    return fwrite(buf, 1, n, file) != (size_t) n ? SUMDIAG_WRITE_FAILED : 0;
+  }
+  while(n > 0){
+    ssize_t done = write(fd, buf, n);
+    if(done < 0 && errno == EINTR){
+      continue;
+    }
+    if(done <= 0){
+      return SUMDIAG_WRITE_FAILED;
+    }
+    buf += done;
+    n -= done;
+  }
+  return 0;
+}
+
+// Most bytes formatting one matrix row can take
+static long row_chars(matrix_t *mat){
+  return (INT_CHARS + 2) + mat->cols * (INT_CHARS + 1) + 1;
+}
+
+// Format row i of mat as matrix_write() prints it. Returns the number
+// of bytes written.
+static long format_row(char *dst, matrix_t *mat, long i){
+  char *p = dst;
+  p += format_int(p, i, 4);
+  *p++ = ':';
+  *p++ = ' ';
+  const int *row = &mat->data[i*mat->cols];
+  for(long j=0; j<mat->cols; j++){
+    int x = mat->layout == MATRIX_ROW_MAJOR ? row[j] : mget(mat, i, j);
+    p += format_int(p, x, 6);
+    *p++ = ' ';
+  }
+  *p++ = '\n';
+  return p - dst;
+}
+
+typedef struct {
+  matrix_t mat;
+  long r0, r1;                  // rows of this round
+  char **bufs;                  // each worker's buffer
+  long *lens;                   // bytes formatted into each
+} write_job_t;
+
+// Pool task: format worker id's share of this round's rows
+static void write_task(void *arg, int id, int nworkers){
+  write_job_t *job = (write_job_t *) arg;
+  long beg, end;
+  sumdiag_pool_share(job->r1 - job->r0, id, nworkers, &beg, &end);
+  long len = 0;
+  for(long i=job->r0+beg; i<job->r0+end; i++){
+    len += format_row(job->bufs[id] + len, &job->mat, i);
+  }
+  job->lens[id] = len;
+}
+
+// Write mat to file in the format of matrix_write() formatting rows
+// with thread_count threads. Returns 0 on success, SUMDIAG_WRITE_NOMEM
+// if the buffers can't be allocated, before anything is written, and
+// SUMDIAG_WRITE_FAILED if writing fails, which may leave partial
+// output.
+int matrix_write_threads(FILE *file, matrix_t mat, int thread_count){
+  if(thread_count > WRITE_MAX_THREADS){
+    thread_count = WRITE_MAX_THREADS;
+  }
+  if(thread_count > mat.rows){
+    thread_count = mat.rows;
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  long per_worker = WRITE_CHUNK / row_chars(&mat);      // rows per worker per round
+  if(per_worker < 1){
+    per_worker = 1;
+  }
+  char *bufs[thread_count];
+  long lens[thread_count];
+  int ret = 0;
+  for(int w=0; w<thread_count; w++){
+    bufs[w] = malloc(row_chars(&mat) * per_worker);
+    ret = ret || bufs[w] == NULL;
+  }
+  if(ret){
+    for(int w=0; w<thread_count; w++){
+      free(bufs[w]);
+    }
+    return SUMDIAG_WRITE_NOMEM;
+  }
+
+  char head[64];
+  int n = snprintf(head, sizeof(head), "%ld x %ld matrix\n", mat.rows, mat.cols);
+  fflush(file);
+  ret = write_out(file, head, n);
+  write_job_t job = {mat, 0, 0, bufs, lens};
+  for(long r=0; !ret && r<mat.rows; r=job.r1){
+    job.r0 = r;
+    job.r1 = r + per_worker * thread_count < mat.rows ? r + per_worker * thread_count : mat.rows;
+    if(sumdiag_pool_run(write_task, &job, thread_count) != 0){
+      for(int w=0; w<thread_count; w++){ // no pool: format each share here
+        write_task(&job, w, thread_count);
+      }
+    }
+    for(int w=0; !ret && w<thread_count; w++){
+      ret = write_out(file, bufs[w], lens[w]);
+    }
+  }
+  for(int w=0; w<thread_count; w++){
+    free(bufs[w]);
+  }
+  return ret;
+}
+
+// Write vec to file in the format of vector_write(). Returns 0 on
+// success or SUMDIAG_WRITE_NOMEM or SUMDIAG_WRITE_FAILED as
+// matrix_write_threads() does.
+int vector_write_buffered(FILE *file, vector_t vec){
+  char *buf = malloc(WRITE_CHUNK);
+  if(buf == NULL){
+    return SUMDIAG_WRITE_NOMEM;
+  }
+  long len = snprintf(buf, WRITE_CHUNK, "%ld x 1 vector\n", vec.len);
+  int ret = 0;
+  fflush(file);
+  for(long i=0; !ret && i<vec.len; i++){
+    if(len > WRITE_CHUNK - 2*(INT_CHARS+2)){
+      ret = write_out(file, buf, len);
+      len = 0;
+    }
+    len += format_int(buf + len, i, 4);
+    buf[len++] = ':';
+    buf[len++] = ' ';
+    len += format_int(buf + len, VGET(vec,i), 4);
+    buf[len++] = '\n';
+  }
+  if(!ret){
+    ret = write_out(file, buf, len);
+  }
+  free(buf);
+  return ret;
+}
@@ -27,6 +27,42 @@ void print_ptrs(void *ptr[], int len){
   }
 }
 
+// Print the weights of each line of el_prof_dump() in the given
+// format, sorted as sites come out in address dependent order: the
+// bytes of the folded formats and the counts and bytes before the
+// stack of the pprof format, after its header line.
+int cmp_str(const void *a, const void *b){
+  return strcmp(*(char **) a, *(char **) b);
+}
+void print_prof_dump(int format){
+  char *text = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&text, &size);
+  int ret = el_prof_dump(out, format);
+  fclose(out);
+  printf("el_prof_dump(%d) returned %d\n", format, ret);
+  char *lines[64];
+  int n = 0;
+  for(char *line = strtok(text, "\n"); line != NULL && n < 64; line = strtok(NULL, "\n")){
+    if(strcmp(line, "MAPPED_LIBRARIES:") == 0){
+      break;
+    }
+    if(format == EL_PROF_PPROF && strncmp(line, "heap profile:", 13) == 0){
+      printf("%s\n", line);
+      continue;
+    }
+    char *cut = format == EL_PROF_PPROF ? strstr(line, " @") : strrchr(line, ' ');
+    if(cut != NULL){
+      lines[n++] = format == EL_PROF_PPROF ? (*cut = '\0', line) : cut+1;
+    }
+  }
+  qsort(lines, n, sizeof(char *), cmp_str);
+  for(int i=0; i<n; i++){
+    printf("%s\n", lines[i]);
+  }
+  free(text);
+}
+
 // void run_test();
 
 int main(int argc, char *argv[]){
@@ -485,6 +521,226 @@ int main(int argc, char *argv[]){
     el_print_stats(); printf("\n");
   } // ENDTEST
 
+  else if( strcmp( test_name, "Lifetime Hints" )==0 ) {
+    PRINT_TEST;
+    // Tests that el_malloc_hint() places long-lived blocks at the
+    // bottom of the heap and short-lived blocks at the top, that the
+    // freed short-lived blocks coalesce into a single block at the
+    // top, and that el_trim_heap() returns the unused pages.
+    void *ptr[16] = {};
+    int len = 0;
+
+    el_append_pages_to_heap(2);
+    ptr[len++] = el_malloc_hint(128, EL_LIFETIME_LONG);
+    ptr[len++] = el_malloc_hint(200, EL_LIFETIME_SHORT);
+    ptr[len++] = el_malloc_hint(64,  EL_LIFETIME_LONG);
+    ptr[len++] = el_malloc_hint(100, EL_LIFETIME_SHORT);
+    printf("MIXED LIFETIMES\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_free(ptr[1]);
+    el_free(ptr[3]);
+    printf("\nFREED SHORT-LIVED\n"); el_print_stats(); printf("\n");
+
+    size_t released = el_trim_heap();
+    printf("TRIMMED %lu bytes\n", released); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Lifetime Prediction" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_LIFETIME_AUTO learns from free timing: blocks of
+    // a size class that are freed quickly are predicted short-lived
+    // while those kept across many allocations are long-lived.
+    printf("before: 48 -> %c  300 -> %c\n",
+           el_predict_lifetime(48), el_predict_lifetime(300));
+
+    void *keep[8] = {};
+    for(int i=0; i<8; i++){
+      keep[i] = el_malloc_hint(300, EL_LIFETIME_AUTO);
+    }
+    for(int i=0; i<80; i++){
+      void *p = el_malloc_hint(48, EL_LIFETIME_AUTO);
+      el_free(p);
+    }
+    for(int i=0; i<8; i++){
+      el_free(keep[i]);
+    }
+    printf("after:  48 -> %c  300 -> %c\n",
+           el_predict_lifetime(48), el_predict_lifetime(300));
+
+    void *p = el_malloc_hint(48, EL_LIFETIME_AUTO);
+    el_blockhead_t *head = PTR_MINUS_BYTES(p, sizeof(el_blockhead_t));
+    printf("auto 48 placed with lifetime %c\n", head->lifetime);
+    el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Heap Profile" )==0 ) {
+    PRINT_TEST;
+    // Tests the sampling heap profiler. Sampling every byte records
+    // every allocation so the estimates are exact: allocations from
+    // two call sites are counted and freed blocks leave the live
+    // totals but not the cumulative totals.
+    el_prof_start(1);
+    void *ptr[16] = {};
+    int len = 0;
+    for(int i=0; i<4; i++){
+      ptr[len++] = el_malloc(100);
+    }
+    ptr[len++] = el_malloc_hint(500, EL_LIFETIME_SHORT);
+    el_prof_print_stats(); printf("\n");
+
+    el_free(ptr[0]);
+    el_free(ptr[4]);
+    el_blockhead_t *head = PTR_MINUS_BYTES(ptr[1], sizeof(el_blockhead_t));
+    printf("block 1 sampled: %d\n", (head->flags & EL_FLAG_SAMPLED) != 0);
+    el_prof_print_stats(); printf("\n");
+
+    el_prof_stop();
+    ptr[0] = el_malloc(100);
+    el_free(ptr[1]);
+    printf("AFTER STOP\n");
+    el_prof_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Heap Profile Dump" )==0 ) {
+    PRINT_TEST;
+    // Tests el_prof_dump(). Sampling every byte records every
+    // allocation so the folded live and total bytes are exact and the
+    // pprof format holds the sample counts and bytes unscaled under
+    // its heap_v2/1 header, leaving the unsampling to pprof.
+    printf("stopped: %d\n", el_prof_dump(stdout, EL_PROF_FOLDED_LIVE));
+    el_prof_start(1);
+    void *ptr[16] = {};
+    int len = 0;
+    for(int i=0; i<4; i++){
+      ptr[len++] = el_malloc(100);
+    }
+    ptr[len++] = el_malloc_hint(500, EL_LIFETIME_SHORT);
+    el_free(ptr[0]);
+    el_free(ptr[4]);
+
+    printf("FOLDED LIVE\n");
+    print_prof_dump(EL_PROF_FOLDED_LIVE); printf("\n");
+    printf("FOLDED TOTAL\n");
+    print_prof_dump(EL_PROF_FOLDED_TOTAL); printf("\n");
+    printf("PPROF\n");
+    print_prof_dump(EL_PROF_PPROF); printf("\n");
+    printf("unknown format: %d\n", el_prof_dump(stdout, 99));
+    el_prof_stop();
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Aligned Allocation" )==0 ) {
+    PRINT_TEST;
+    // Tests el_malloc_aligned(). An odd sized block leaves the next
+    // free space unaligned; aligned allocations split off the space
+    // below the aligned address as a separate available block, or
+    // use the block as is when it is already aligned.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(22);
+    ptr[len++] = el_malloc_aligned(64, 100);
+    ptr[len++] = el_malloc_aligned(8, 16);
+    ptr[len++] = el_malloc_aligned(3, 16);
+    printf("ALIGNED\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+    printf("ptr[1] %% 64: %lu\n", ((size_t) ptr[1]) % 64);
+    printf("ptr[2] %% 8:  %lu\n", ((size_t) ptr[2]) % 8);
+
+    el_free(ptr[1]);
+    el_free(ptr[2]);
+    el_free(ptr[0]);
+    printf("\nFREED\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Prefault Populate" )==0 ) {
+    PRINT_TEST;
+    // Tests EL_PREFAULT_POPULATE: once the available bytes drop below
+    // the watermark the heap grows by the requested pages, and an
+    // allocation larger than the free space grows the heap instead
+    // of failing.
+    int ret = el_set_prefault(EL_PREFAULT_POPULATE, 2048, 2);
+    printf("el_set_prefault(): %d\n", ret);
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(1000);
+    printf("ABOVE WATERMARK\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(1500);
+    printf("BELOW WATERMARK\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(20000);
+    printf("LARGER THAN HEAP\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Prefault Thread" )==0 ) {
+    PRINT_TEST;
+    // Tests EL_PREFAULT_THREAD: crossing the watermark has the
+    // background thread stage pages at the end of the heap which are
+    // then adopted by the next growth of the heap, here an allocation
+    // that does not fit.
+    int ret = el_set_prefault(EL_PREFAULT_THREAD, 2048, 4);
+    printf("el_set_prefault(): %d\n", ret);
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(2500);
+    printf("BELOW WATERMARK\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(6000);
+    printf("ADOPTED STAGED PAGES\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    ret = el_set_prefault(EL_PREFAULT_OFF, 0, 0);
+    ptr[len++] = el_malloc(20000);
+    printf("OFF: el_set_prefault(): %d  malloc(20000): %p\n", ret, ptr[len-1]);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Handle Compaction" )==0 ) {
+    PRINT_TEST;
+    // Tests relocatable handles. Freeing every other handle block
+    // fragments the heap; el_compact() slides the unlocked handle
+    // blocks down while the el_malloc() block and the locked handle
+    // block stay put. Handle contents survive the move and the free
+    // space at the top can then be trimmed.
+    el_append_pages_to_heap(1);
+    el_handle_t h[8] = {};
+    for(int i=0; i<8; i++){
+      h[i] = el_halloc(300);
+      char *str = el_hlock(h[i]);
+      sprintf(str, "handle %d", i);
+      el_hunlock(h[i]);
+    }
+    void *fixed = el_malloc(100);
+    el_handle_t last = el_halloc(300);
+    for(int i=0; i<8; i+=2){
+      el_hfree(h[i]);
+    }
+    char *locked = el_hlock(h[5]);
+    printf("FRAGMENTED\n"); el_print_stats(); printf("\n");
+
+    size_t moved = el_compact();
+    printf("COMPACTED, moved %lu bytes\n", moved); el_print_stats(); printf("\n");
+
+    for(int i=1; i<8; i+=2){
+      char *str = el_hlock(h[i]);
+      printf("h[%d] = %d: '%s'\n", i, h[i], str);
+      el_hunlock(h[i]);
+    }
+    printf("locked h[5] unmoved: %d\n", locked == el_hlock(h[5]));
+    el_hunlock(h[5]);
+    el_hunlock(h[5]);
+    el_free(fixed);
+    el_hfree(last);
+
+    moved = el_compact();
+    size_t released = el_trim_heap();
+    printf("\nCOMPACTED AGAIN, moved %lu bytes, trimmed %lu bytes\n", moved, released);
+    el_print_stats(); printf("\n");
+  } // ENDTEST
+
   else{
     printf("No test named '%s' found\n",test_name);
     return 1;